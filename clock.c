@@ -0,0 +1,334 @@
+/*******************************************************************************
+ * Copyright (c) 2018 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+#include <debug.h>
+#include <arch/x86.h>
+#include <kernel/vm.h>
+#include <platform/sand.h>
+#include <platform/clock.h>
+#include <platform/vmcall.h>
+#include <kernel/spinlock.h>
+#include "trusty_time_page.h"
+
+#define CPUID_LEAF_TSC_CRYSTAL  0x15
+#define CPUID_LEAF_FREQ_INFO    0x16
+
+#define HPET_GCAP_ID            0x00
+#define HPET_GEN_CONF           0x10
+#define HPET_MAIN_COUNTER       0xF0
+#define HPET_ENABLE_CNF         (1 << 0)
+#define HPET_MAX_PERIOD_FS      100000000ULL /* 100ns, per HPET spec */
+
+#define FS_PER_NS               1000000ULL
+
+/* HPET window used to measure TSC rate */
+#define CALIBRATE_MS            10
+
+static uint64_t tsc_khz = TSC_DEFAULT_KHZ;
+
+/*
+ * Fixed-point factors, value = (tsc * mult) >> shift. Use the largest
+ * shift for which (to << shift) still fits in 64 bits, the 128-bit
+ * product in clock_conv_apply() absorbs the large mult.
+ */
+#define CLOCK_CONV_INIT(to, from) { \
+    .mult = ((uint64_t)(to) << __builtin_clzll(to)) / (from), \
+    .shift = __builtin_clzll(to), \
+}
+
+/* Start from the default rate so current_time() works before calibration */
+struct clock_tsc_conv clock_tsc = {
+    .to_ns = CLOCK_CONV_INIT(NS_PER_MS, TSC_DEFAULT_KHZ),
+    .to_us = CLOCK_CONV_INIT(NS_PER_MS / NS_PER_US, TSC_DEFAULT_KHZ),
+    .to_ms = CLOCK_CONV_INIT(1ULL, TSC_DEFAULT_KHZ),
+};
+struct clock_conv ns_to_us_conv = CLOCK_CONV_INIT(1ULL, NS_PER_US);
+struct clock_conv ns_to_ms_conv = CLOCK_CONV_INIT(1ULL, NS_PER_MS);
+
+/* Registered with the VMM, see clock_init_pvclock() */
+static union {
+    struct pvclock_time_info pv;
+    uint8_t page[PAGE_SIZE];
+} pvclock_page __ALIGNED(PAGE_SIZE);
+
+const struct pvclock_time_info *clock_pvclock;
+static uint32_t pvclock_version;
+static spin_lock_t pvclock_lock = SPIN_LOCK_INITIAL_VALUE;
+
+/* Mapped read-only into trusted apps, see get_time_page() */
+static union {
+    trusty_time_page_t tp;
+    uint8_t page[PAGE_SIZE];
+} time_page __ALIGNED(PAGE_SIZE);
+
+static uint32_t hpet_read32(uint64_t base, uint32_t reg)
+{
+    return *(volatile uint32_t *)(base + reg);
+}
+
+static void hpet_write32(uint64_t base, uint32_t reg, uint32_t val)
+{
+    *(volatile uint32_t *)(base + reg) = val;
+}
+
+/*
+ * TSC = crystal * EBX / EAX from CPUID.15H. The crystal frequency is not
+ * enumerated on every SKU (ECX == 0) and older parts lack the leaf, both
+ * fall back to CPUID.16H on its own. That is the base frequency in MHz,
+ * which the invariant TSC nominally runs at, so only an approximation.
+ */
+static uint64_t tsc_khz_from_cpuid(void)
+{
+    uint64_t info[4];
+    uint64_t max_leaf;
+
+    __cpuid(info, 0, 0);
+    max_leaf = info[0];
+
+    if (max_leaf >= CPUID_LEAF_TSC_CRYSTAL) {
+        __cpuid(info, CPUID_LEAF_TSC_CRYSTAL, 0);
+        if (info[0] && info[1] && info[2] / 1000)
+            return (info[2] / 1000) * info[1] / info[0];
+    }
+
+    /* Rounded to 1MHz, the real rate may differ by the crystal error */
+    if (max_leaf >= CPUID_LEAF_FREQ_INFO) {
+        __cpuid(info, CPUID_LEAF_FREQ_INFO, 0);
+        if (info[0] & 0xFFFF)
+            return (info[0] & 0xFFFF) * 1000;
+    }
+
+    return 0;
+}
+
+/*
+ * Measure TSC against HPET main counter. HPET is reached through the
+ * kernel linear mapping, no VM is available at this point.
+ */
+static uint64_t tsc_khz_from_hpet(void)
+{
+    uint64_t base = KERNEL_ASPACE_BASE + HPET_BASE_ADDRESS;
+    uint64_t period_fs, ticks, elapsed_ns;
+    uint64_t tsc0, tsc1;
+    uint32_t hpet0, hpet1, conf;
+
+    period_fs = hpet_read32(base, HPET_GCAP_ID + 4);
+    if (!period_fs || period_fs > HPET_MAX_PERIOD_FS)
+        return 0;
+
+    conf = hpet_read32(base, HPET_GEN_CONF);
+    if (!(conf & HPET_ENABLE_CNF))
+        hpet_write32(base, HPET_GEN_CONF, conf | HPET_ENABLE_CNF);
+
+    ticks = MS_TO_NS(CALIBRATE_MS) * FS_PER_NS / period_fs;
+
+    hpet0 = hpet_read32(base, HPET_MAIN_COUNTER);
+    tsc0 = clock_read_tsc();
+    do {
+        hpet1 = hpet_read32(base, HPET_MAIN_COUNTER);
+    } while ((uint32_t)(hpet1 - hpet0) < ticks);
+    tsc1 = clock_read_tsc();
+
+    elapsed_ns = (uint64_t)(uint32_t)(hpet1 - hpet0) * period_fs / FS_PER_NS;
+    if (!elapsed_ns)
+        return 0;
+
+    return (tsc1 - tsc0) * NS_PER_MS / elapsed_ns;
+}
+
+/* Consistent copy of the VMM clock parameters */
+static void pvclock_snapshot(struct pvclock_time_info *snap)
+{
+    const struct pvclock_time_info *pv = &pvclock_page.pv;
+    uint32_t version;
+
+    do {
+        version = pv->version;
+        __asm__ __volatile__ ("" ::: "memory");
+        snap->tsc_timestamp = pv->tsc_timestamp;
+        snap->system_time = pv->system_time;
+        snap->tsc_to_system_mul = pv->tsc_to_system_mul;
+        snap->tsc_shift = pv->tsc_shift;
+        snap->flags = pv->flags;
+        __asm__ __volatile__ ("" ::: "memory");
+    } while ((version & 1) || version != pv->version);
+
+    snap->version = version;
+}
+
+/* TSC kHz = 10^6 * 2^32 / (mul * 2^shift) */
+static uint64_t tsc_khz_from_pvclock(const struct pvclock_time_info *snap)
+{
+    uint64_t khz;
+
+    if (!snap->tsc_to_system_mul)
+        return 0;
+
+    khz = (NS_PER_MS << 32) / snap->tsc_to_system_mul;
+
+    return snap->tsc_shift < 0 ? khz << -snap->tsc_shift : khz >> snap->tsc_shift;
+}
+
+/*
+ * Register the clock page with the VMM. Only a TSC-stable clock is
+ * used, all CPUs read the same page.
+ */
+static uint64_t clock_init_pvclock(void)
+{
+    struct pvclock_time_info snap;
+
+    if (!vmm_has_feature(VMM_FEATURE_PVCLOCK))
+        return 0;
+
+    if (vmm_register_pvclock(platform_kernel_paddr(&pvclock_page))) {
+        dprintf(CRITICAL, "Failed to register pvclock page\n");
+        return 0;
+    }
+
+    pvclock_snapshot(&snap);
+    if (!snap.version || !(snap.flags & PVCLOCK_TSC_STABLE_BIT)) {
+        dprintf(INFO, "pvclock not TSC-stable, not used\n");
+        return 0;
+    }
+
+    pvclock_version = snap.version;
+
+    return tsc_khz_from_pvclock(&snap);
+}
+
+static void clock_conv_init(struct clock_conv *conv, uint64_t to, uint64_t from)
+{
+    struct clock_conv c = CLOCK_CONV_INIT(to, from);
+
+    *conv = c;
+}
+
+static void clock_update_time_page(const struct pvclock_time_info *snap)
+{
+    trusty_time_page_t *tp = &time_page.tp;
+
+    tp->seq++;
+    __asm__ __volatile__ ("" ::: "memory");
+
+    tp->version = TRUSTY_TIME_PAGE_VERSION;
+    tp->tsc_base = snap ? snap->tsc_timestamp : 0;
+    tp->ns_base = snap ? snap->system_time : 0;
+    tp->mult = clock_tsc.to_ns.mult;
+    tp->shift = clock_tsc.to_ns.shift;
+
+    __asm__ __volatile__ ("" ::: "memory");
+    tp->seq++;
+}
+
+/* ns = ((tsc << s) * mul) >> 32 of the pvclock, folded into one factor */
+static void clock_conv_from_pvclock(const struct pvclock_time_info *snap,
+        struct clock_conv *to_ns)
+{
+    if (snap->tsc_shift < 0) {
+        to_ns->mult = snap->tsc_to_system_mul;
+        to_ns->shift = 32 - snap->tsc_shift;
+    } else {
+        to_ns->mult = (uint64_t)snap->tsc_to_system_mul << snap->tsc_shift;
+        to_ns->shift = 32;
+    }
+}
+
+/*
+ * Publish new factors. With a pvclock, the ns factor comes from the same
+ * snapshot clock_now_ns() reads, so the time page and time agree. Callers
+ * serialize, readers retry on seq.
+ */
+static void clock_update_conv(const struct pvclock_time_info *snap)
+{
+    __atomic_store_n(&clock_tsc.seq, clock_tsc.seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (snap && snap->tsc_to_system_mul && snap->tsc_shift > -31) {
+        clock_conv_from_pvclock(snap, &clock_tsc.to_ns);
+    } else {
+        clock_conv_init(&clock_tsc.to_ns, NS_PER_MS, tsc_khz);
+    }
+    clock_conv_init(&clock_tsc.to_us, NS_PER_MS / NS_PER_US, tsc_khz);
+    clock_conv_init(&clock_tsc.to_ms, 1, tsc_khz);
+
+    __atomic_store_n(&clock_tsc.seq, clock_tsc.seq + 1, __ATOMIC_RELEASE);
+
+    clock_update_time_page(snap);
+}
+
+void platform_init_clock(void)
+{
+    struct pvclock_time_info snap;
+    uint64_t khz, pv_khz;
+
+    /* The VMM knows the rate it runs the TSC at, no calibration error */
+    pv_khz = clock_init_pvclock();
+
+    khz = pv_khz;
+    if (!khz)
+        khz = tsc_khz_from_cpuid();
+    if (!khz)
+        khz = tsc_khz_from_hpet();
+
+    if (khz) {
+        tsc_khz = khz;
+    } else {
+        dprintf(CRITICAL, "Failed to calibrate TSC, assume %llu kHz\n",
+                TSC_DEFAULT_KHZ);
+    }
+
+    if (pv_khz) {
+        clock_pvclock = &pvclock_page.pv;
+        pvclock_snapshot(&snap);
+    }
+
+    clock_update_conv(pv_khz ? &snap : NULL);
+
+    dprintf(INFO, "TSC frequency: %llu kHz%s\n", tsc_khz,
+            clock_pvclock ? " (pvclock)" : "");
+}
+
+/*
+ * The VMM rewrites the pvclock after e.g. a migration or resume, which
+ * clock_now_ns() follows on its own but the time page and the TSC
+ * factors do not.
+ */
+void clock_sync_pvclock(void)
+{
+    spin_lock_saved_state_t state;
+    struct pvclock_time_info snap;
+    uint64_t khz;
+
+    if (!clock_pvclock || clock_pvclock->version == pvclock_version)
+        return;
+
+    spin_lock_irqsave(&pvclock_lock, state);
+
+    pvclock_snapshot(&snap);
+    if (snap.version != pvclock_version) {
+        pvclock_version = snap.version;
+        khz = tsc_khz_from_pvclock(&snap);
+        if (khz)
+            tsc_khz = khz;
+        clock_update_conv(&snap);
+    }
+
+    spin_unlock_irqrestore(&pvclock_lock, state);
+}
+
+paddr_t clock_time_page_paddr(void)
+{
+    return vaddr_to_paddr(&time_page);
+}
@@ -138,17 +138,14 @@ int platform_dgetc(char *c, bool wait)
 }
 
 #if PRINT_USE_MMIO
-void init_uart(void)
+uint64_t uart_mmio_paddr(void)
 {
-    uint64_t io_base = 0;
-
-    io_base = (uint64_t)(pci_read32(SERIAL_PCI_BUS, SERIAL_PCI_DEV, SERIAL_PCI_FUN, 0x10) & ~0xF);
-
-    mmio_base_addr = KERNEL_ASPACE_BASE + io_base;
+    return (uint64_t)(pci_read32(SERIAL_PCI_BUS, SERIAL_PCI_DEV, SERIAL_PCI_FUN, 0x10) & ~0xF);
+}
 
-#ifdef EPT_DEBUG
-    make_ept_update_vmcall(ADD, io_base, 4096);
-#endif
+void init_uart(void)
+{
+    mmio_base_addr = KERNEL_ASPACE_BASE + uart_mmio_paddr();
 
     uart_putc('\n');
 }
@@ -0,0 +1,183 @@
+/*******************************************************************************
+ * Copyright (c) 2018 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+#include <err.h>
+#include <debug.h>
+#include <stdio.h>
+#include <arch/defines.h>
+#include <arch/ops.h>
+#include <kernel/thread.h>
+#include <kernel/event.h>
+#include <lk/init.h>
+#include <platform/defer.h>
+#if WITH_LIB_CONSOLE
+#include <lib/console.h>
+#endif
+
+#define DEFER_QUEUE_SIZE    64
+#define DEFER_QUEUE_MASK    (DEFER_QUEUE_SIZE - 1)
+
+/*
+ * Bounded MPSC ring with a sequence number per slot. A slot is free for
+ * position pos when seq == pos and holds the entry of pos when
+ * seq == pos + 1, so producers only contend on head and never on the
+ * consumer's tail.
+ */
+struct defer_slot {
+    uint64_t seq;
+    platform_work_fn fn;
+    void *arg;
+};
+
+struct defer_queue {
+    uint64_t head __ALIGNED(CACHE_LINE);    /* next position to fill */
+    uint64_t tail __ALIGNED(CACHE_LINE);    /* next position to run */
+    uint64_t done;
+    uint64_t dropped;
+    bool ready;
+    event_t event;
+    struct defer_slot slot[DEFER_QUEUE_SIZE];
+} __ALIGNED(CACHE_LINE);
+
+static struct defer_queue defer_queue[SMP_MAX_CPUS];
+
+status_t platform_defer_work(platform_work_fn fn, void *arg)
+{
+    struct defer_queue *q;
+    struct defer_slot *slot;
+    spin_lock_saved_state_t state;
+    uint64_t pos, seq;
+
+    /* Stay on this CPU's queue until the entry is published */
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    q = &defer_queue[arch_curr_cpu_num()];
+    if (!__atomic_load_n(&q->ready, __ATOMIC_ACQUIRE)) {
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+        return ERR_NOT_READY;
+    }
+
+    pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = &q->slot[pos & DEFER_QUEUE_MASK];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, false,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if ((int64_t)(seq - pos) < 0) {
+            q->dropped++;
+            arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+            return ERR_NO_MEMORY;
+        } else {
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->fn = fn;
+    slot->arg = arg;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    event_signal(&q->event, false);
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return NO_ERROR;
+}
+
+/* Single consumer, the work thread of the queue's CPU */
+static bool defer_queue_run_one(struct defer_queue *q)
+{
+    struct defer_slot *slot = &q->slot[q->tail & DEFER_QUEUE_MASK];
+    platform_work_fn fn;
+    void *arg;
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != q->tail + 1)
+        return false;
+
+    fn = slot->fn;
+    arg = slot->arg;
+    __atomic_store_n(&slot->seq, q->tail + DEFER_QUEUE_SIZE, __ATOMIC_RELEASE);
+    q->tail++;
+
+    fn(arg);
+    q->done++;
+
+    return true;
+}
+
+static int defer_work_thread(void *arg)
+{
+    struct defer_queue *q = arg;
+
+    for (;;) {
+        event_wait(&q->event);
+        while (defer_queue_run_one(q))
+            ;
+    }
+
+    return 0;
+}
+
+/*
+ * Secondary CPUs only run init hooks from LK_INIT_LEVEL_THREADING on, so
+ * each queue is set up here together with its thread.
+ */
+static void defer_thread_init(uint level)
+{
+    uint32_t cpu = arch_curr_cpu_num();
+    struct defer_queue *q = &defer_queue[cpu];
+    char name[16];
+    thread_t *t;
+    uint32_t i;
+
+    for (i = 0; i < DEFER_QUEUE_SIZE; i++)
+        q->slot[i].seq = i;
+
+    event_init(&q->event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+    snprintf(name, sizeof(name), "defer-%u", cpu);
+    t = thread_create(name, defer_work_thread, q,
+            HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!t)
+        panic("failed to create %s thread\n", name);
+
+    thread_set_pinned_cpu(t, cpu);
+    thread_detach_and_resume(t);
+
+    __atomic_store_n(&q->ready, true, __ATOMIC_RELEASE);
+}
+
+LK_INIT_HOOK_FLAGS(defer_thread, defer_thread_init,
+        LK_INIT_LEVEL_THREADING, LK_INIT_FLAG_ALL_CPUS);
+
+#if WITH_LIB_CONSOLE
+static int cmd_defer_stats(int argc, const cmd_args *argv)
+{
+    uint32_t cpu;
+
+    for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++)
+        dprintf(ALWAYS, "cpu%u: queued %llu done %llu dropped %llu\n", cpu,
+                defer_queue[cpu].head, defer_queue[cpu].done,
+                defer_queue[cpu].dropped);
+
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("deferstat", "dump deferred work queue statistics", &cmd_defer_stats)
+STATIC_COMMAND_END(deferstat);
+#endif
@@ -13,26 +13,196 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  *******************************************************************************/
+#include <err.h>
 #include <lib/sm/sm_err.h>
 #include <platform/vmcall.h>
+#include <platform/sand.h>
+
+#if SMC_PROFILE
+#include <macros.h>
+#include <arch/defines.h>
+#include <arch/ops.h>
+#include <platform/clock.h>
+#include <platform/histogram.h>
+#if WITH_LIB_CONSOLE
+#include <lib/console.h>
+#endif
+#endif
 
 extern smc32_handler_t sm_fastcall_table[SMC_NUM_ENTITIES];
 extern uint32_t sm_nr_fastcall_functions;
 extern smc32_handler_t sm_fastcall_function_table[];
 extern long smc_undefined(smc32_args_t * args);
 
+#if SMC_PROFILE
+/* Calls are keyed by entity, separately for fastcalls and stdcalls */
+#define SMC_PROF_KEYS           (2 * SMC_NUM_ENTITIES)
+#define SMC_PROF_KEY(smc_nr)    \
+    ((SMC_IS_FASTCALL(smc_nr) ? SMC_NUM_ENTITIES : 0) + SMC_ENTITY(smc_nr))
+
+/* Secure monitor functions past this share the last counter */
+#define SMC_PROF_MONITOR_FUNCS  32
+
+struct smc_prof_key {
+    uint64_t calls;
+    struct log2_hist secure;    /* ns from entry to return to NS */
+    struct log2_hist ns;        /* ns spent in NS before this call */
+};
+
+struct smc_prof_cpu {
+    uint32_t key;               /* call being served */
+    uint64_t enter_tsc;
+    uint64_t exit_tsc;
+    uint64_t monitor[SMC_PROF_MONITOR_FUNCS + 1];
+    struct smc_prof_key prof[SMC_PROF_KEYS];
+} __ALIGNED(CACHE_LINE);
+
+static struct smc_prof_cpu smc_prof[SMP_MAX_CPUS];
+
+static void smc_prof_exit(void)
+{
+    struct smc_prof_cpu *p = &smc_prof[arch_curr_cpu_num()];
+    uint64_t now = clock_read_tsc();
+
+    if (p->enter_tsc)
+        log2_hist_add(&p->prof[p->key].secure,
+                clock_tsc_to_ns(now - p->enter_tsc));
+
+    p->exit_tsc = now;
+}
+
+static void smc_prof_enter(uint32_t smc_nr)
+{
+    struct smc_prof_cpu *p = &smc_prof[arch_curr_cpu_num()];
+    uint64_t now = clock_read_tsc();
+
+    p->key = SMC_PROF_KEY(smc_nr);
+    p->enter_tsc = now;
+    p->prof[p->key].calls++;
+
+    if (p->exit_tsc)
+        log2_hist_add(&p->prof[p->key].ns, clock_tsc_to_ns(now - p->exit_tsc));
+}
+
+static void smc_prof_monitor(u_int function)
+{
+    struct smc_prof_cpu *p = &smc_prof[arch_curr_cpu_num()];
+
+    p->monitor[MIN(function, SMC_PROF_MONITOR_FUNCS)]++;
+}
+
+#if WITH_LIB_CONSOLE
+static int cmd_smc_prof(int argc, const cmd_args *argv)
+{
+    struct smc_prof_key *k;
+    uint32_t cpu, key, fn;
+
+    for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        for (key = 0; key < SMC_PROF_KEYS; key++) {
+            k = &smc_prof[cpu].prof[key];
+            if (!k->calls)
+                continue;
+
+            dprintf(ALWAYS, "cpu%u %s entity %u: %llu calls\n", cpu,
+                    key < SMC_NUM_ENTITIES ? "stdcall" : "fastcall",
+                    key % SMC_NUM_ENTITIES, k->calls);
+            dprintf(ALWAYS, "  time in secure world:\n");
+            log2_hist_dump(&k->secure, "ns");
+            dprintf(ALWAYS, "  time in NS world before call:\n");
+            log2_hist_dump(&k->ns, "ns");
+        }
+
+        for (fn = 0; fn <= SMC_PROF_MONITOR_FUNCS; fn++) {
+            if (smc_prof[cpu].monitor[fn])
+                dprintf(ALWAYS, "cpu%u monitor function %u%s: %llu calls\n",
+                        cpu, fn, fn == SMC_PROF_MONITOR_FUNCS ? "+" : "",
+                        smc_prof[cpu].monitor[fn]);
+        }
+    }
+
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("smcprof", "dump SMC profile", &cmd_smc_prof)
+STATIC_COMMAND_END(smcprof);
+#endif
+#else
+static inline void smc_prof_exit(void) {}
+static inline void smc_prof_enter(uint32_t smc_nr) {}
+static inline void smc_prof_monitor(u_int function) {}
+#endif
+
+static smc64_handler_t sm_fastcall64_table[SMC_NUM_ENTITIES];
+
+status_t smc64_register_fastcall(uint32_t entity, smc64_handler_t handler)
+{
+    smc64_handler_t none = NULL;
+
+    if (entity >= SMC_NUM_ENTITIES || !handler)
+        return ERR_INVALID_ARGS;
+
+    if (!__atomic_compare_exchange_n(&sm_fastcall64_table[entity], &none,
+                handler, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        return ERR_ALREADY_EXISTS;
+
+    return NO_ERROR;
+}
+
+static inline void smc_args_widen(smc64_args_t *args64, const smc32_args_t *args)
+{
+    uint32_t i;
+
+    args64->smc_nr = args->smc_nr;
+    for (i = 0; i < SMC_NUM_PARAMS_64; i++)
+        args64->params[i] = args->params[i];
+}
+
+static inline void smc_args_narrow(smc32_args_t *args, const smc64_args_t *args64)
+{
+    uint32_t i;
+
+    args->smc_nr = args64->smc_nr;
+    for (i = 0; i < SMC_NUM_PARAMS_64; i++)
+        args->params[i] = (uint32_t)args64->params[i];
+}
+
+/*
+ * The vmcall always moves full 64-bit registers. SMC32 calls see the low
+ * halves through args, SMC64 fastcalls get the full values.
+ */
 void sm_sched_nonsecure(long retval, smc32_args_t * args)
 {
     uint32_t smc_nr;
     u_int entry_nr;
     smc32_handler_t handler_fn = NULL;
+    smc64_handler_t handler64_fn;
+    smc64_args_t args64;
+
+    smc_args_widen(&args64, args);
 return_sm_err:
 
-    make_smc_vmcall(args, retval);
+    platform_flush_forwarded_irqs();
+    smc_prof_exit();
+    make_smc_vmcall(&args64, retval);
 
+    smc_args_narrow(args, &args64);
     smc_nr = args->smc_nr;
+    smc_prof_enter(smc_nr);
+
+#if SMC_RING
+    /* Any entry from NS serves queued requests, saving their kicks */
+    smc_ring_drain();
+#endif
+
     if (SMC_IS_SMC64(smc_nr)) {
-        retval = SM_ERR_NOT_SUPPORTED;
+        handler64_fn = NULL;
+        if (SMC_IS_FASTCALL(smc_nr))
+            handler64_fn = __atomic_load_n(&sm_fastcall64_table[SMC_ENTITY(smc_nr)],
+                    __ATOMIC_ACQUIRE);
+
+        /* SMC64 stdcalls are not supported by lib/sm */
+        retval = handler64_fn ? handler64_fn(&args64) : SM_ERR_NOT_SUPPORTED;
         goto return_sm_err;
     }
     if (!SMC_IS_FASTCALL(smc_nr)) {
@@ -43,6 +213,7 @@ return_sm_err:
     entry_nr = SMC_ENTITY(smc_nr);
     handler_fn = sm_fastcall_table[entry_nr];
     retval = handler_fn(args);
+    smc_args_widen(&args64, args);
     goto return_sm_err;
 }
 
@@ -51,6 +222,8 @@ long smc_fastcall_secure_monitor(smc32_args_t * args)
     u_int function = SMC_FUNCTION(args->smc_nr);
     smc32_handler_t handler_fn = NULL;
 
+    smc_prof_monitor(function);
+
     if (function < sm_nr_fastcall_functions)
         handler_fn = sm_fastcall_function_table[function];
 
@@ -16,6 +16,8 @@
 
 
 DEF_SYSCALL(0xa0, get_device_info, long, 1, trusty_device_info_t *info)
+DEF_SYSCALL(0xa6, get_time_page, long, 1, void **page)
+DEF_SYSCALL(0xa7, get_irq_stats, long, 4, uint32_t cpu, uint32_t first, void *stats, uint32_t count)
 #ifdef SPI_CONTROLLER
 DEF_SYSCALL(0xa1, trusty_spi_init, void, 0)
 DEF_SYSCALL(0xa2, trusty_spi_set_cs, void, 1, uint8_t flag)
@@ -0,0 +1,142 @@
+/*******************************************************************************
+ * Copyright (c) 2018 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+#ifndef __SAND_CLOCK_H
+#define __SAND_CLOCK_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <platform/pvclock.h>
+
+#define NS_PER_US   1000ULL
+#define NS_PER_MS   1000000ULL
+#define NS_PER_SEC  1000000000ULL
+
+#define MS_TO_NS(ms) ((ms)*NS_PER_MS)
+#define US_TO_NS(us) ((us)*NS_PER_US)
+
+#define HPET_BASE_ADDRESS   0xFED00000
+
+/* Used only if neither CPUID nor HPET can tell us the TSC frequency */
+#define TSC_DEFAULT_KHZ     2000000ULL
+
+static inline uint64_t clock_read_tsc(void)
+{
+    uint32_t low, high;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (low), "=d" (high));
+
+    return ((uint64_t)high << 32) | (uint64_t)low;
+}
+
+/*
+ * Determine the invariant TSC frequency. Must run on the BSP before the
+ * first call to current_time().
+ */
+void platform_init_clock(void);
+
+/* Physical page holding trusty_time_page_t for user mappings */
+paddr_t clock_time_page_paddr(void);
+
+/*
+ * TSC conversions are a multiply and a shift with factors computed once
+ * by platform_init_clock(), no division on the hot path.
+ */
+struct clock_conv {
+    uint64_t mult;
+    uint32_t shift;
+};
+
+/*
+ * TSC factors, rewritten when the VMM changes the pvclock. Read them only
+ * through clock_tsc_conv_read(), seq is odd while an update is going on.
+ */
+struct clock_tsc_conv {
+    volatile uint32_t seq;
+    struct clock_conv to_ns;
+    struct clock_conv to_us;
+    struct clock_conv to_ms;
+};
+
+extern struct clock_tsc_conv clock_tsc;
+extern struct clock_conv ns_to_us_conv;
+extern struct clock_conv ns_to_ms_conv;
+
+/* VMM clock page, used instead of the TSC factors when set */
+extern const struct pvclock_time_info *clock_pvclock;
+
+static inline uint64_t clock_conv_apply(const struct clock_conv *conv,
+        uint64_t val)
+{
+    return (uint64_t)(((unsigned __int128)val * conv->mult) >> conv->shift);
+}
+
+/* Consistent copy of one factor of clock_tsc */
+static inline struct clock_conv clock_tsc_conv_read(const struct clock_conv *conv)
+{
+    struct clock_conv c;
+    uint32_t seq;
+
+    do {
+        seq = __atomic_load_n(&clock_tsc.seq, __ATOMIC_ACQUIRE);
+        c = *conv;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != clock_tsc.seq);
+
+    return c;
+}
+
+static inline uint64_t clock_tsc_apply(const struct clock_conv *conv,
+        uint64_t val)
+{
+    struct clock_conv c = clock_tsc_conv_read(conv);
+
+    return clock_conv_apply(&c, val);
+}
+
+static inline uint64_t clock_tsc_to_ns(uint64_t tsc)
+{
+    return clock_tsc_apply(&clock_tsc.to_ns, tsc);
+}
+
+/* Monotonic time since TSC reset, or since VM start with a pvclock */
+static inline uint64_t clock_now_ns(void)
+{
+    if (clock_pvclock)
+        return pvclock_read_ns(clock_pvclock);
+
+    return clock_tsc_apply(&clock_tsc.to_ns, clock_read_tsc());
+}
+
+static inline uint64_t clock_now_us(void)
+{
+    if (clock_pvclock)
+        return clock_conv_apply(&ns_to_us_conv, pvclock_read_ns(clock_pvclock));
+
+    return clock_tsc_apply(&clock_tsc.to_us, clock_read_tsc());
+}
+
+static inline uint64_t clock_now_ms(void)
+{
+    if (clock_pvclock)
+        return clock_conv_apply(&ns_to_ms_conv, pvclock_read_ns(clock_pvclock));
+
+    return clock_tsc_apply(&clock_tsc.to_ms, clock_read_tsc());
+}
+
+/* Pick up new pvclock parameters for the time page, cheap if unchanged */
+void clock_sync_pvclock(void);
+
+#endif
@@ -0,0 +1,31 @@
+/*******************************************************************************
+ * Copyright (c) 2018 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+#ifndef __SAND_DEFER_H
+#define __SAND_DEFER_H
+
+#include <sys/types.h>
+
+typedef void (*platform_work_fn)(void *arg);
+
+/*
+ * Queue fn(arg) to run in the deferred work thread of the calling CPU.
+ * Safe from interrupt handlers, which should then return INT_RESCHEDULE
+ * so the work thread gets to run. Returns ERR_NO_MEMORY if the queue is
+ * full and ERR_NOT_READY before LK_INIT_LEVEL_THREADING on this CPU.
+ */
+status_t platform_defer_work(platform_work_fn fn, void *arg);
+
+#endif
@@ -0,0 +1,44 @@
+/*******************************************************************************
+ * Copyright (c) 2018 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+#ifndef __SAND_HISTOGRAM_H
+#define __SAND_HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * Power-of-two histogram, bucket 0 counts zero samples and bucket n
+ * counts samples in [2^(n-1), 2^n). The last bucket takes everything
+ * above its lower bound.
+ */
+#define LOG2_HIST_BUCKETS   32
+
+struct log2_hist {
+    uint64_t bucket[LOG2_HIST_BUCKETS];
+};
+
+static inline void log2_hist_add(struct log2_hist *hist, uint64_t val)
+{
+    uint32_t n = val ? 64 - __builtin_clzll(val) : 0;
+
+    if (n >= LOG2_HIST_BUCKETS)
+        n = LOG2_HIST_BUCKETS - 1;
+
+    hist->bucket[n]++;
+}
+
+void log2_hist_dump(const struct log2_hist *hist, const char *unit);
+
+#endif
@@ -0,0 +1,67 @@
+/*******************************************************************************
+ * Copyright (c) 2018 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+#ifndef __SAND_PVCLOCK_H
+#define __SAND_PVCLOCK_H
+
+#include <stdint.h>
+
+/*
+ * Paravirtual clock page kept up to date by the VMM, same layout as
+ * KVM's pvclock_vcpu_time_info:
+ *
+ *   ns = system_time + ((((tsc - tsc_timestamp) << tsc_shift) * mul) >> 32)
+ *
+ * with a negative tsc_shift meaning a right shift. version is odd while
+ * the VMM rewrites the parameters.
+ */
+struct pvclock_time_info {
+    volatile uint32_t version;
+    uint32_t pad0;
+    uint64_t tsc_timestamp;
+    uint64_t system_time;
+    uint32_t tsc_to_system_mul;
+    int8_t tsc_shift;
+    uint8_t flags;
+    uint8_t pad[2];
+} __attribute__((packed));
+
+/* Same time on every CPU, the page may be shared */
+#define PVCLOCK_TSC_STABLE_BIT  (1 << 0)
+
+static inline uint64_t pvclock_read_ns(const struct pvclock_time_info *pv)
+{
+    uint32_t version, low, high;
+    uint64_t delta, ns;
+
+    do {
+        version = pv->version;
+        __asm__ __volatile__ ("lfence; rdtsc" : "=a" (low), "=d" (high) :: "memory");
+
+        delta = (((uint64_t)high << 32) | low) - pv->tsc_timestamp;
+        if (pv->tsc_shift < 0)
+            delta >>= -pv->tsc_shift;
+        else
+            delta <<= pv->tsc_shift;
+        ns = pv->system_time + (uint64_t)(((unsigned __int128)delta *
+                    pv->tsc_to_system_mul) >> 32);
+
+        __asm__ __volatile__ ("" ::: "memory");
+    } while ((version & 1) || version != pv->version);
+
+    return ns;
+}
+
+#endif
@@ -18,19 +18,61 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/types.h>
 #include <platform/sand_defs.h>
 #include <platform/uart.h>
 #include <platform/pci_config.h>
 #include "trusty_device_info.h"
+#include "trusty_irq_stats.h"
 
 extern device_sec_info_t* g_sec_info;
 
 void platform_init_interrupts(void);
 void platform_init_timer(void);
+void platform_timer_tick(void);
+
+/*
+ * Handler on a vector shared with other drivers. Sets *handled if its
+ * device raised the interrupt, which stops the chain. Unlike exclusive
+ * handlers it must not issue the EOI, the dispatcher does so once.
+ */
+typedef enum handler_return (*int_shared_handler)(void *arg, bool *handled);
+
+status_t register_int_handler_shared(unsigned int vector,
+        int_shared_handler handler, void *arg);
+status_t unregister_int_handler_shared(unsigned int vector,
+        int_shared_handler handler, void *arg);
+
+paddr_t platform_kernel_paddr(const void *va);
+#if IRQ_FW_BATCH
+void platform_flush_forwarded_irqs(void);
+void platform_poll_forwarded_irqs(void);
+#else
+static inline void platform_flush_forwarded_irqs(void) {}
+static inline void platform_poll_forwarded_irqs(void) {}
+#endif
+
+#if SMC_RING
+long smc_ring_setup(paddr_t pa, size_t size);
+void smc_ring_drain(void);
+long smc_ring_run(void);
+#endif
+bool platform_latch_masked_irq(unsigned int vector, bool soft);
+status_t platform_get_irq_stats(uint32_t cpu, uint32_t first,
+        trusty_irq_stats_t *stats, uint32_t count);
 void platform_init_uart(void);
+#if PRINT_USE_MMIO
+uint64_t uart_mmio_paddr(void);
+#endif
 void clear_sensitive_data(void);
 bool is_lk_boot_complete(void);
 
+#if WITH_SM_WALL
+/* Let secure timers fire up to slack ms late, 0 disables coalescing */
+status_t platform_timer_set_slack(lk_time_t slack);
+void platform_dump_timer_stats(void);
+#endif
+
 uint8_t pci_read8(uint8_t bus,
             uint8_t device,
             uint8_t function,
@@ -72,8 +114,25 @@ void x86_mp_init(uint32_t ap_startup_addr);
 
 #if ATTKB_HECI
 void cse_init(void);
+uint64_t cse_mmio_paddr(void);
 uint32_t get_attkb(uint8_t *attkb);
 #endif
+static inline void __cpuid(uint64_t cpu_info[4], uint64_t leaf, uint64_t subleaf)
+{
+    __asm__ __volatile__ (
+        "pushq %%rbx;" /* save the ebx */
+        "cpuid;"
+        "mov %%rbx, %1;" /* save what cpuid just put in ebx */
+        "popq %%rbx;" /* restore the old ebx */
+        : "=a" (cpu_info[0]),
+          "=r" (cpu_info[1]),
+          "=c" (cpu_info[2]),
+          "=d" (cpu_info[3])
+        : "a" (leaf), "c" (subleaf)
+        : "cc"
+        );
+}
+
 static inline void x86_set_cr8(uint64_t in_val)
 {
        __asm__ __volatile__ (
@@ -18,7 +18,7 @@
 
 #include <stdint.h>
 
-#define TIMEOUT 400000
+#define SPI_TIMEOUT_MS 400
 
 struct spi_tran_data{
     void *tx;
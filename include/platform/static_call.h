@@ -0,0 +1,57 @@
+/*******************************************************************************
+ * Copyright (c) 2018 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+#ifndef __SAND_STATIC_CALL_H
+#define __SAND_STATIC_CALL_H
+
+/*
+ * A static call is a hook whose target is chosen at boot but which is
+ * called like a plain function. name is a 5-byte "jmp rel32" trampoline,
+ * callers reach it with a direct call and static_call_update() rewrites
+ * the jump, so no indirect branch is left on the path.
+ *
+ * Declare the hook with a normal prototype and define it once with
+ * DEFINE_STATIC_CALL(name, default_target) at file scope.
+ */
+#define STATIC_CALL_INSN_SIZE   5
+
+/*
+ * The jump is emitted by hand so it is always the rel32 form, and 8-byte
+ * aligned so its displacement can be replaced by one atomic store.
+ */
+#define DEFINE_STATIC_CALL(name, target) \
+    __asm__(".pushsection .text, \"ax\"\n" \
+            ".balign 8\n" \
+            ".globl " #name "\n" \
+            ".type " #name ", @function\n" \
+            #name ":\n" \
+            ".byte 0xe9\n" \
+            ".long " #target " - (. + 4)\n" \
+            ".size " #name ", . - " #name "\n" \
+            ".popsection\n")
+
+void static_call_update_addr(void *tramp, void *target);
+
+/*
+ * Retarget hook name to func. Only the calling CPU is serialized, so do
+ * this before other CPUs can reach the hook, e.g. from platform_init().
+ */
+#define static_call_update(name, func) \
+    do { \
+        __typeof__(&(name)) __target = (func); \
+        static_call_update_addr((void *)&(name), (void *)__target); \
+    } while (0)
+
+#endif
@@ -16,12 +16,41 @@
 #ifndef __VMCALL_H
 #define __VMCALL_H
 
+#include <stdbool.h>
 #include <lib/sm.h>
 
-void make_smc_vmcall_evmm(smc32_args_t *args, long ret);
-void make_smc_vmcall_acrn(smc32_args_t *args, long ret);
+/* Registers of an SMC as passed by the vmcall ABI, valid for SMC32 too */
+#define SMC_NUM_PARAMS_64   3
+
+typedef struct smc64_args {
+    uint32_t smc_nr;
+    uint64_t params[SMC_NUM_PARAMS_64];
+} smc64_args_t;
+
+typedef long (*smc64_handler_t)(smc64_args_t *args);
+
+/*
+ * Fast paths a VMM may advertise in EAX of CPUID leaf 0x40000001. Valid
+ * once smc_init() ran.
+ */
+#define VMM_FEATURE_EPT_BATCH   (1U << 0)   /* batched EPT update hypercall */
+#define VMM_FEATURE_PVCLOCK     (1U << 2)   /* paravirtual clock page */
+#define VMM_FEATURE_TLB_FLUSH   (1U << 3)   /* TLB flush hypercall */
+
+bool vmm_has_feature(uint32_t feature);
+/* Have the VMM maintain a struct pvclock_time_info at pa */
+status_t vmm_register_pvclock(paddr_t pa);
+
+/* Serve SMC64 fastcalls of entity, one handler per entity */
+status_t smc64_register_fastcall(uint32_t entity, smc64_handler_t handler);
+
+void make_smc_vmcall_evmm(smc64_args_t *args, long ret);
+void make_smc_vmcall_acrn(smc64_args_t *args, long ret);
+long make_pvclock_vmcall_evmm(paddr_t pa);
+long make_pvclock_vmcall_acrn(paddr_t pa);
 void make_get_secinfo_vmcall(void *dst);
-extern void (*make_smc_vmcall)(smc32_args_t *, long);
+/* Static call to one of the above, selected by smc_init() */
+void make_smc_vmcall(smc64_args_t *args, long ret);
 
 #ifdef EPT_DEBUG
 typedef enum {
@@ -29,7 +58,17 @@ typedef enum {
     REMOVE,
 }ept_update_t;
 
+/* One region of a batched EPT update, layout shared with the VMM */
+typedef struct {
+    uint64_t action;
+    uint64_t start;
+    uint64_t size;
+} ept_update_desc_t;
+
+#define EPT_BATCH_MAX   16
+
 void make_ept_update_vmcall(ept_update_t action, uint64_t start, uint64_t size);
+void make_ept_batch_update_vmcall(const ept_update_desc_t *desc, uint32_t count);
 #endif
 
 #endif
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2018 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TRUSTY_IRQ_STATS_H
+#define __TRUSTY_IRQ_STATS_H
+
+#include <stdint.h>
+
+/* Same as INT_VECTORS of the kernel */
+#define TRUSTY_IRQ_VECTORS	0xFF
+
+/* Per-CPU counters of one interrupt vector, see get_irq_stats() */
+typedef struct {
+	uint64_t handled;	/* delivered to a secure handler */
+	uint64_t forwarded;	/* bounced to Non-Secure world */
+	uint64_t cycles;	/* TSC cycles spent in the secure handler */
+} trusty_irq_stats_t;
+
+#endif
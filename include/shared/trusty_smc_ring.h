@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2018 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TRUSTY_SMC_RING_H
+#define __TRUSTY_SMC_RING_H
+
+#include <stdint.h>
+
+/*
+ * Ring of SMC requests in Non-Secure memory, registered once with
+ * SMC_SC_SMC_RING_SETUP. NS fills ring[req_prod % size].req and then
+ * advances req_prod. Trusty overwrites each slot with its response, in
+ * order, and advances rsp_prod.
+ *
+ * Trusty serves the ring whenever it is entered through any SMC, so NS
+ * only needs SMC_FC_SMC_RING_KICK when req_prod moved past req_event,
+ * i.e. when Trusty asked to be told about the next request.
+ *
+ * Queued stdcalls are only served by SMC_SC_SMC_RING_RUN, which NS issues
+ * after queueing one. Requests behind a stdcall wait for it, responses
+ * stay in order.
+ *
+ * NS must keep req_prod - rsp_cons <= size, where rsp_cons is the
+ * number of responses it consumed. Only 32-bit calls of the entities
+ * Trusty allows for the ring may be queued, others fail with
+ * SM_ERR_NOT_ALLOWED.
+ */
+typedef union {
+	struct {
+		uint32_t smc_nr;
+		uint32_t params[3];
+	} req;
+	struct {
+		int64_t ret;
+		uint64_t reserved;
+	} rsp;
+} trusty_smc_ring_entry_t;
+
+typedef struct {
+	volatile uint32_t req_prod;	/* written by NS */
+	volatile uint32_t req_event;	/* written by Trusty */
+	volatile uint32_t rsp_prod;	/* written by Trusty */
+	uint32_t size;			/* entries, a power of two */
+	uint8_t pad[48];
+	trusty_smc_ring_entry_t ring[];
+} trusty_smc_ring_t;
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2018 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TRUSTY_TIME_PAGE_H
+#define __TRUSTY_TIME_PAGE_H
+
+#include <stdint.h>
+
+#define TRUSTY_TIME_PAGE_VERSION    1
+
+/*
+ * Read-only page the kernel maps into every trusted app that asks for it
+ * with get_time_page(). It carries the TSC to ns conversion used by the
+ * kernel's current_time(), so apps can read monotonic time without a
+ * syscall:
+ *
+ *   ns = ns_base + (((tsc - tsc_base) * mult) >> shift)
+ *
+ * seq is odd while the kernel rewrites the parameters.
+ */
+typedef struct {
+	volatile uint32_t seq;
+	uint32_t version;
+	uint64_t tsc_base;
+	uint64_t ns_base;
+	uint64_t mult;
+	uint32_t shift;
+	uint32_t reserved;
+} trusty_time_page_t;
+
+static inline uint64_t trusty_time_page_rdtsc(void)
+{
+	uint32_t low, high;
+
+	/* keep rdtsc from being hoisted above the seq read */
+	__asm__ __volatile__ ("lfence; rdtsc" : "=a" (low), "=d" (high) :: "memory");
+
+	return ((uint64_t)high << 32) | (uint64_t)low;
+}
+
+static inline uint64_t trusty_time_page_ns(const trusty_time_page_t *tp)
+{
+	uint32_t seq;
+	uint64_t ns;
+
+	do {
+		seq = tp->seq;
+		__asm__ __volatile__ ("" ::: "memory");
+		ns = tp->ns_base + (uint64_t)(((unsigned __int128)
+			(trusty_time_page_rdtsc() - tp->tsc_base) * tp->mult) >> tp->shift);
+		__asm__ __volatile__ ("" ::: "memory");
+	} while ((seq & 1) || seq != tp->seq);
+
+	return ns;
+}
+
+#endif
@@ -15,6 +15,8 @@
  *******************************************************************************/
 #include <err.h>
 #include <lib/sm.h>
+#include <arch/defines.h>
+#include <arch/ops.h>
 #include <arch/local_apic.h>
 #ifdef ENABLE_FPU
 #include <arch/fpu.h>
@@ -22,10 +24,16 @@
 #include <kernel/thread.h>
 #include <platform/interrupts.h>
 #include <platform/sand.h>
+#include <platform/clock.h>
+#include <platform/defer.h>
 #include <lk/init.h>
 #include <debug.h>
-
-static spin_lock_t lock;
+#include <stdlib.h>
+#include <string.h>
+#if WITH_LIB_CONSOLE
+#include <lib/console.h>
+#endif
+#include "trusty_irq_stats.h"
 
 void x86_gpf_handler(x86_iframe_t *frame);
 void x86_invop_handler(x86_iframe_t *frame);
@@ -34,12 +42,115 @@ void x86_unhandled_exception(x86_iframe_t *frame);
 void x86_pfe_handler(x86_iframe_t *frame);
 #endif
 
-struct int_handler_struct {
-    int_handler handler;
+struct int_handler_entry {
+    union {
+        int_handler handler;
+        int_shared_handler shared_handler;
+    };
     void *arg;
 };
 
-static struct int_handler_struct int_handler_table[INT_VECTORS];
+/*
+ * Either one exclusive handler or a chain of up to INT_CHAIN_MAX shared
+ * handlers. The first INT_CHAIN_INLINE entries live in the descriptor
+ * itself, which keeps the common case to a single cache line, the rest in
+ * a heap-allocated overflow array.
+ */
+#define INT_CHAIN_INLINE    3
+#define INT_CHAIN_MAX       8
+
+struct int_handler_struct {
+    uint32_t count;
+    bool shared;
+    struct int_handler_entry entry[INT_CHAIN_INLINE];
+    struct int_handler_entry *overflow;
+} __ALIGNED(CACHE_LINE);
+
+/*
+ * Handlers are published as one descriptor pointer per vector so that
+ * platform_irq() never sees a half-written chain and never takes a lock.
+ * Descriptors are never modified once published, a registration builds a
+ * new one. A replaced descriptor goes back to the pool only after every
+ * CPU has left the read side it might have been seen in.
+ *
+ * Writers hold lock from loading the installed descriptor until the new
+ * one and int_handler_map are published, so no writer ever copies from a
+ * descriptor that is being retired.
+ */
+static struct int_handler_struct *int_handler_table[INT_VECTORS];
+static spin_lock_t lock;
+
+/*
+ * At most one live descriptor per vector, plus the new and the retired one
+ * of each registration in flight. Should the pool still run dry, e.g. with
+ * many concurrent registrations, descriptors come from the heap.
+ */
+#define INT_DESC_HEADROOM   (2 * SMP_MAX_CPUS)
+#define INT_DESC_POOL_SIZE  (INT_VECTORS + INT_DESC_HEADROOM)
+#define INT_DESC_POOL_WORDS ((INT_DESC_POOL_SIZE + 63) / 64)
+
+static struct int_handler_struct int_desc_pool[INT_DESC_POOL_SIZE];
+static uint64_t int_desc_used[INT_DESC_POOL_WORDS];
+
+/* Odd while the CPU is reading int_handler_table */
+struct int_reader_state {
+    volatile uint32_t seq;
+} __ALIGNED(CACHE_LINE);
+
+static struct int_reader_state int_reader[SMP_MAX_CPUS];
+
+/* Only written by the owning CPU from platform_irq() */
+struct int_cpu_stats {
+    trusty_irq_stats_t vector[INT_VECTORS];
+} __ALIGNED(CACHE_LINE);
+
+static struct int_cpu_stats int_stats[SMP_MAX_CPUS];
+
+/* One bit per vector with a handler installed, see smc_intc_get_next_irq() */
+#define INT_MAP_WORDS   ((INT_VECTORS + 63) / 64)
+static uint64_t int_handler_map[INT_MAP_WORDS];
+
+/*
+ * Per-CPU masking of secure vectors. A masked vector that fires is EOI'd
+ * and latched in pending, unmask_interrupt() re-raises it by self-IPI so
+ * it takes the regular path, exclusive handlers EOI it once more. Ticks
+ * raised in software (SMC_SC_LK_TIMER) never went through the APIC, they
+ * are latched in soft_pending and replayed directly. Only touched by the
+ * owning CPU with interrupts disabled.
+ */
+struct int_mask_state {
+    uint64_t masked[INT_MAP_WORDS];
+    uint64_t pending[INT_MAP_WORDS];
+    uint64_t soft_pending[INT_MAP_WORDS];
+} __ALIGNED(CACHE_LINE);
+
+static struct int_mask_state int_mask[SMP_MAX_CPUS];
+
+#if IRQ_FW_BATCH
+/*
+ * Foreign vectors are latched here and re-injected by self-IPI only when
+ * the CPU returns to Non-Secure world, so a burst of NS interrupts costs
+ * one world switch. A batch is sent early once it holds FW_BATCH_MAX
+ * vectors, when a latched vector fires again, when an interrupt is taken
+ * in a TA, or once its oldest vector waited FW_BATCH_MAX_NS.
+ *
+ * There is no secure timer tick, the age is checked on every forwarded
+ * interrupt and by kernel loops that busy-wait with interrupts enabled,
+ * see platform_poll_forwarded_irqs().
+ */
+#define FW_BATCH_MAX        8
+#define FW_BATCH_MAX_NS     US_TO_NS(50)
+
+struct int_fw_batch {
+    uint64_t pending[INT_MAP_WORDS];
+    uint32_t count;
+    uint64_t first_ns;
+    uint64_t batches;
+    uint64_t vectors;
+} __ALIGNED(CACHE_LINE);
+
+static struct int_fw_batch int_fw_batch[SMP_MAX_CPUS];
+#endif
 
 #define PIC1_DATA 0x21
 #define PIC2_DATA 0xA1
@@ -79,28 +190,248 @@ void platform_init_interrupts(void)
     x86_set_cr8(0xF);
 }
 
+static bool int_dispatch(unsigned int vector, enum handler_return *ret);
+
+/*
+ * Mask state is per-CPU, a caller of mask_interrupt()/unmask_interrupt()
+ * must run both on the same CPU: with interrupts disabled across the
+ * pair, or from a thread pinned to the CPU. Otherwise the vector stays
+ * masked on the first CPU and its latched pending bit is never replayed.
+ */
+static inline bool int_mask_cpu_fixed(void)
+{
+    return arch_ints_disabled() ||
+        get_current_thread()->pinned_cpu == (int)arch_curr_cpu_num();
+}
+
+/* Masks vector on the calling CPU only */
 status_t mask_interrupt(unsigned int vector)
 {
+    spin_lock_saved_state_t state;
+
+    DEBUG_ASSERT(int_mask_cpu_fixed());
+
     if (vector >= INT_VECTORS)
         return ERR_INVALID_ARGS;
 
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    int_mask[arch_curr_cpu_num()].masked[vector / 64] |= BIT_VALUE64(vector % 64);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
     return NO_ERROR;
 }
 
 void platform_mask_irqs(void)
 {
+    spin_lock_saved_state_t state;
+
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    memset(int_mask[arch_curr_cpu_num()].masked, 0xff,
+            sizeof(int_mask[0].masked));
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
+/*
+ * Unmasks vector on the calling CPU and replays it if it fired while
+ * masked there, see int_mask_cpu_fixed(). A vector that nobody handles
+ * any more ends up in NS, like any foreign interrupt. A reschedule
+ * requested by a software tick handler is honoured only when called from
+ * thread context with interrupts enabled, otherwise it is left to the
+ * next preemption point.
+ */
 status_t unmask_interrupt(unsigned int vector)
 {
+    struct int_mask_state *mask;
+    spin_lock_saved_state_t state;
+    enum handler_return ret = INT_NO_RESCHEDULE;
+    bool preemptible = !arch_ints_disabled();
+    uint64_t bit = BIT_VALUE64(vector % 64);
+
+    DEBUG_ASSERT(int_mask_cpu_fixed());
+
     if (vector >= INT_VECTORS)
         return ERR_INVALID_ARGS;
 
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    mask = &int_mask[arch_curr_cpu_num()];
+    mask->masked[vector / 64] &= ~bit;
+
+    if (mask->pending[vector / 64] & bit) {
+        mask->pending[vector / 64] &= ~bit;
+        send_self_ipi(vector);
+    }
+
+    if (mask->soft_pending[vector / 64] & bit) {
+        mask->soft_pending[vector / 64] &= ~bit;
+        if (!int_dispatch(vector, &ret))
+            send_self_ipi(vector);
+    }
+
+    if (ret == INT_RESCHEDULE && preemptible)
+        thread_preempt();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
     return NO_ERROR;
 }
 
+/*
+ * Latch vector as pending if it is masked on this CPU. soft is set for
+ * interrupts raised in software, which must not be EOI'd on replay. Must
+ * be called with interrupts disabled.
+ */
+bool platform_latch_masked_irq(unsigned int vector, bool soft)
+{
+    struct int_mask_state *mask = &int_mask[arch_curr_cpu_num()];
+    uint64_t bit = BIT_VALUE64(vector % 64);
+
+    if (!(mask->masked[vector / 64] & bit))
+        return false;
+
+    if (soft)
+        mask->soft_pending[vector / 64] |= bit;
+    else
+        mask->pending[vector / 64] |= bit;
+
+    return true;
+}
+
 extern enum handler_return sm_handle_irq(void);
 
+static struct int_handler_entry *int_chain_entry(struct int_handler_struct *desc,
+        uint32_t i)
+{
+    if (i < INT_CHAIN_INLINE)
+        return &desc->entry[i];
+
+    return &desc->overflow[i - INT_CHAIN_INLINE];
+}
+
+/*
+ * Runs the handlers of vector. Only copying the chain out of the handler
+ * table is the read side: handlers may switch to NS or (un)register
+ * handlers themselves, which must not hold up int_wait_for_readers().
+ * The locked increment orders the seq update before the table load,
+ * which int_wait_for_readers() relies on. Shared handlers run in
+ * registration order until one claims the interrupt, which is then EOI'd
+ * here. Returns false if nobody handled it.
+ */
+static bool int_dispatch(unsigned int vector, enum handler_return *ret)
+{
+    struct int_reader_state *reader = &int_reader[arch_curr_cpu_num()];
+    struct int_handler_entry chain[INT_CHAIN_MAX];
+    struct int_handler_struct *desc;
+    bool handled = false, shared = false;
+    uint32_t i, count = 0;
+
+    __atomic_fetch_add(&reader->seq, 1, __ATOMIC_SEQ_CST);
+
+    desc = __atomic_load_n(&int_handler_table[vector], __ATOMIC_ACQUIRE);
+    if (desc) {
+        shared = desc->shared;
+        count = desc->count;
+        for (i = 0; i < count; i++)
+            chain[i] = *int_chain_entry(desc, i);
+    }
+
+    __atomic_fetch_add(&reader->seq, 1, __ATOMIC_RELEASE);
+
+    if (count && !shared) {
+        *ret = chain[0].handler(chain[0].arg);
+        return true;
+    }
+
+    for (i = 0; i < count && !handled; i++) {
+        if (chain[i].shared_handler(chain[i].arg, &handled) == INT_RESCHEDULE)
+            *ret = INT_RESCHEDULE;
+    }
+    if (handled)
+        lapic_eoi();
+
+    return handled;
+}
+
+#if IRQ_FW_BATCH
+static bool int_fw_batch_due(struct int_fw_batch *batch)
+{
+    return batch->count &&
+        clock_now_ns() - batch->first_ns >= FW_BATCH_MAX_NS;
+}
+
+static enum handler_return int_forward_batched(unsigned int vector,
+        bool from_user)
+{
+    struct int_fw_batch *batch = &int_fw_batch[arch_curr_cpu_num()];
+    uint64_t *word = &batch->pending[vector / 64];
+    uint64_t bit = BIT_VALUE64(vector % 64);
+
+    lapic_eoi();
+
+    /* NS did not get to service it yet, no point in holding it longer */
+    if (*word & bit)
+        return sm_handle_irq();
+
+    if (!batch->count)
+        batch->first_ns = clock_now_ns();
+
+    *word |= bit;
+    batch->count++;
+
+    if (batch->count >= FW_BATCH_MAX || from_user || int_fw_batch_due(batch))
+        return sm_handle_irq();
+
+    return INT_NO_RESCHEDULE;
+}
+
+/*
+ * Forward the batch of this CPU if it is due. For kernel code polling
+ * hardware with interrupts enabled, where no interrupt or return to NS
+ * may come along to flush it. Called from thread context.
+ */
+void platform_poll_forwarded_irqs(void)
+{
+    spin_lock_saved_state_t state;
+    enum handler_return ret = INT_NO_RESCHEDULE;
+
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    if (int_fw_batch_due(&int_fw_batch[arch_curr_cpu_num()]))
+        ret = sm_handle_irq();
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (ret == INT_RESCHEDULE && !arch_ints_disabled())
+        thread_preempt();
+}
+
+/* Called right before every switch to Non-Secure world */
+void platform_flush_forwarded_irqs(void)
+{
+    struct int_fw_batch *batch;
+    spin_lock_saved_state_t state;
+    uint32_t i;
+    uint64_t bits;
+
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    batch = &int_fw_batch[arch_curr_cpu_num()];
+    if (batch->count) {
+        for (i = 0; i < INT_MAP_WORDS; i++) {
+            bits = batch->pending[i];
+            batch->pending[i] = 0;
+            while (bits) {
+                send_self_ipi(i * 64 + __builtin_ctzll(bits));
+                bits &= bits - 1;
+            }
+        }
+        batch->batches++;
+        batch->vectors += batch->count;
+        batch->count = 0;
+    }
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+#endif
+
 enum handler_return platform_irq(x86_iframe_t *frame)
 {
     /* get the current vector */
@@ -122,32 +453,386 @@ enum handler_return platform_irq(x86_iframe_t *frame)
         return ret;
     }
 
-    /* EOI should be issued by ISR */
-    if (int_handler_table[vector].handler) {
-        ret = int_handler_table[vector].
-        handler(int_handler_table[vector].arg);
+    trusty_irq_stats_t *stats = &int_stats[arch_curr_cpu_num()].vector[vector];
+    bool secure = int_handler_map[vector / 64] & BIT_VALUE64(vector % 64);
+    uint64_t start = clock_read_tsc();
+
+    /* EOI should be issued by exclusive ISRs */
+    if (secure && platform_latch_masked_irq(vector, false)) {
+        lapic_eoi();
+    } else if (secure && int_dispatch(vector, &ret)) {
+        stats->handled++;
+        stats->cycles += clock_read_tsc() - start;
     } else {
+        stats->forwarded++;
+#if IRQ_FW_BATCH
+        ret = int_forward_batched(vector, (frame->cs & 3) == 3);
+#else
         FW_INT_TO_NS(vector);
         ret = sm_handle_irq();
+#endif
     }
 
     return ret;
 }
 
+static struct int_handler_struct *int_desc_alloc(void)
+{
+    struct int_handler_struct *desc;
+    uint64_t used, avail;
+    uint32_t word, idx;
+
+    for (word = 0; word < INT_DESC_POOL_WORDS; word++) {
+        used = __atomic_load_n(&int_desc_used[word], __ATOMIC_RELAXED);
+        do {
+            avail = ~used;
+            if (word == INT_DESC_POOL_SIZE / 64)
+                avail &= BIT_VALUE64(INT_DESC_POOL_SIZE % 64) - 1;
+            if (!avail)
+                break;
+            idx = __builtin_ctzll(avail);
+        } while (!__atomic_compare_exchange_n(&int_desc_used[word], &used,
+                    used | BIT_VALUE64(idx), false,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+        if (avail) {
+            desc = &int_desc_pool[word * 64 + idx];
+            memset(desc, 0, sizeof(*desc));
+            return desc;
+        }
+    }
+
+    /* The heap may block, registrations from IRQ context stay in the pool */
+    if (arch_ints_disabled())
+        return NULL;
+
+    desc = memalign(CACHE_LINE, sizeof(*desc));
+    if (desc)
+        memset(desc, 0, sizeof(*desc));
+
+    return desc;
+}
+
+static bool int_desc_from_pool(struct int_handler_struct *desc)
+{
+    return desc >= int_desc_pool && desc < int_desc_pool + INT_DESC_POOL_SIZE;
+}
+
+static void int_desc_free(void *desc)
+{
+    free(((struct int_handler_struct *)desc)->overflow);
+    free(desc);
+}
+
+/*
+ * Frees heap memory directly or, with interrupts disabled, from the
+ * deferred work thread. Should that queue be full the memory is leaked
+ * rather than freed from IRQ context.
+ */
+static void int_heap_free(platform_work_fn fn, void *ptr)
+{
+    if (!arch_ints_disabled()) {
+        fn(ptr);
+        return;
+    }
+
+    if (platform_defer_work(fn, ptr) != NO_ERROR)
+        dprintf(CRITICAL, "interrupts: leaking %p, defer queue full\n", ptr);
+}
+
+static void int_desc_release(struct int_handler_struct *desc)
+{
+    uint32_t idx;
+
+    if (!int_desc_from_pool(desc)) {
+        int_heap_free(int_desc_free, desc);
+        return;
+    }
+
+    if (desc->overflow)
+        int_heap_free(free, desc->overflow);
+
+    idx = desc - int_desc_pool;
+    __atomic_fetch_and(&int_desc_used[idx / 64], ~BIT_VALUE64(idx % 64),
+            __ATOMIC_RELEASE);
+}
+
+/* Wait until no CPU can still hold a descriptor it read before now */
+static void int_wait_for_readers(void)
+{
+    uint32_t seq[SMP_MAX_CPUS];
+    uint32_t cpu;
+
+    for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++)
+        seq[cpu] = __atomic_load_n(&int_reader[cpu].seq, __ATOMIC_ACQUIRE);
+
+    for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!(seq[cpu] & 1))
+            continue;
+        while (__atomic_load_n(&int_reader[cpu].seq, __ATOMIC_ACQUIRE) == seq[cpu])
+            __asm__ __volatile__("pause":::"memory");
+    }
+}
+
+/*
+ * Install desc on vector and return the descriptor it replaces. Called
+ * with lock held, so the table and int_handler_map change together.
+ */
+static struct int_handler_struct *int_publish(unsigned int vector,
+        struct int_handler_struct *desc)
+{
+    struct int_handler_struct *old = int_handler_table[vector];
+
+    __atomic_store_n(&int_handler_table[vector], desc, __ATOMIC_RELEASE);
+
+    if (desc)
+        __atomic_fetch_or(&int_handler_map[vector / 64],
+                BIT_VALUE64(vector % 64), __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_and(&int_handler_map[vector / 64],
+                ~BIT_VALUE64(vector % 64), __ATOMIC_RELAXED);
+
+    return old;
+}
+
+/* Free a replaced descriptor once no reader can see it, without lock */
+static void int_retire(struct int_handler_struct *old)
+{
+    if (!old)
+        return;
+
+    int_wait_for_readers();
+    int_desc_release(old);
+}
+
+/*
+ * Empty shared chain descriptor, allocated before taking lock. It has
+ * room for INT_CHAIN_MAX entries, or only INT_CHAIN_INLINE when called
+ * with interrupts disabled.
+ */
+static struct int_handler_struct *int_chain_alloc(void)
+{
+    struct int_handler_struct *desc;
+
+    desc = int_desc_alloc();
+    if (!desc)
+        return NULL;
+
+    desc->shared = true;
+    if (arch_ints_disabled())
+        return desc;
+
+    desc->overflow = calloc(INT_CHAIN_MAX - INT_CHAIN_INLINE,
+            sizeof(struct int_handler_entry));
+    if (!desc->overflow) {
+        int_desc_release(desc);
+        return NULL;
+    }
+
+    return desc;
+}
+
+static uint32_t int_chain_room(struct int_handler_struct *desc)
+{
+    return desc->overflow ? INT_CHAIN_MAX : INT_CHAIN_INLINE;
+}
+
+/* Index of {handler, arg} in the shared chain desc, or -1 */
+static int int_chain_find(struct int_handler_struct *desc,
+        int_shared_handler handler, void *arg)
+{
+    struct int_handler_entry *entry;
+    uint32_t i;
+
+    for (i = 0; i < desc->count; i++) {
+        entry = int_chain_entry(desc, i);
+        if (entry->shared_handler == handler && entry->arg == arg)
+            return i;
+    }
+
+    return -1;
+}
+
+/* Append the chain of old, if any, to desc, leaving out entry skip */
+static void int_chain_copy(struct int_handler_struct *desc,
+        struct int_handler_struct *old, int skip)
+{
+    uint32_t i;
+
+    for (i = 0; old && i < old->count; i++) {
+        if ((int)i != skip)
+            *int_chain_entry(desc, desc->count++) = *int_chain_entry(old, i);
+    }
+}
+
+/*
+ * Lock-free against platform_irq(), registrations are serialized by lock.
+ * Replaces whatever is installed on vector, including a chain of shared
+ * handlers.
+ */
 void register_int_handler(unsigned int vector, int_handler handler, void *arg)
 {
+    struct int_handler_struct *desc = NULL, *old;
+    spin_lock_saved_state_t state;
+
     if (vector >= INT_VECTORS)
         panic("register_int_handler: vector out of range %d\n", vector);
 
+    if (handler) {
+        desc = int_desc_alloc();
+        if (!desc)
+            panic("register_int_handler: out of memory for vector %d\n", vector);
+
+        desc->count = 1;
+        desc->entry[0].handler = handler;
+        desc->entry[0].arg = arg;
+    }
+
+    spin_lock_irqsave(&lock, state);
+    old = int_publish(vector, desc);
+    spin_unlock_irqrestore(&lock, state);
+
+    int_retire(old);
+}
+
+/* Append {handler, arg} to the chain of vector */
+status_t register_int_handler_shared(unsigned int vector,
+        int_shared_handler handler, void *arg)
+{
+    struct int_handler_struct *desc, *old = NULL;
+    spin_lock_saved_state_t state;
+    status_t ret = NO_ERROR;
+    uint32_t count;
+
+    if (vector >= INT_VECTORS || !handler)
+        return ERR_INVALID_ARGS;
+
+    desc = int_chain_alloc();
+    if (!desc)
+        return ERR_NO_MEMORY;
+
+    spin_lock_irqsave(&lock, state);
+
+    old = int_handler_table[vector];
+    count = old ? old->count : 0;
+
+    if (old && !old->shared) {
+        ret = ERR_ALREADY_EXISTS;
+    } else if (count == INT_CHAIN_MAX) {
+        ret = ERR_TOO_BIG;
+    } else if (count >= int_chain_room(desc)) {
+        ret = ERR_NO_MEMORY;
+    } else {
+        int_chain_copy(desc, old, -1);
+        int_chain_entry(desc, desc->count)->shared_handler = handler;
+        int_chain_entry(desc, desc->count)->arg = arg;
+        desc->count++;
+        old = int_publish(vector, desc);
+    }
+
+    spin_unlock_irqrestore(&lock, state);
+
+    if (ret != NO_ERROR) {
+        int_desc_release(desc);
+        return ret;
+    }
+
+    int_retire(old);
+
+    return NO_ERROR;
+}
+
+/* Remove {handler, arg} from the chain of vector */
+status_t unregister_int_handler_shared(unsigned int vector,
+        int_shared_handler handler, void *arg)
+{
+    struct int_handler_struct *desc, *old;
     spin_lock_saved_state_t state;
+    status_t ret = NO_ERROR;
+    int idx = -1;
+
+    if (vector >= INT_VECTORS)
+        return ERR_INVALID_ARGS;
+
+    desc = int_chain_alloc();
+    if (!desc)
+        return ERR_NO_MEMORY;
+
     spin_lock_irqsave(&lock, state);
 
-    int_handler_table[vector].arg = arg;
-    int_handler_table[vector].handler = handler;
+    old = int_handler_table[vector];
+    if (old && old->shared)
+        idx = int_chain_find(old, handler, arg);
+
+    if (idx < 0) {
+        ret = ERR_NOT_FOUND;
+    } else if (old->count - 1 > int_chain_room(desc)) {
+        ret = ERR_NO_MEMORY;
+    } else {
+        int_chain_copy(desc, old, idx);
+        if (!desc->count) {
+            int_publish(vector, NULL);
+        } else {
+            int_publish(vector, desc);
+            desc = NULL;
+        }
+    }
 
     spin_unlock_irqrestore(&lock, state);
+
+    if (desc)
+        int_desc_release(desc);
+
+    if (ret != NO_ERROR)
+        return ret;
+
+    int_retire(old);
+
+    return NO_ERROR;
+}
+
+/* Copy vectors [first, first + count) of one CPU's counters */
+status_t platform_get_irq_stats(uint32_t cpu, uint32_t first,
+        trusty_irq_stats_t *stats, uint32_t count)
+{
+    if (cpu >= SMP_MAX_CPUS || first >= INT_VECTORS ||
+            count > INT_VECTORS - first)
+        return ERR_INVALID_ARGS;
+
+    memcpy(stats, &int_stats[cpu].vector[first], count * sizeof(*stats));
+
+    return NO_ERROR;
+}
+
+#if WITH_LIB_CONSOLE
+static int cmd_irq_stats(int argc, const cmd_args *argv)
+{
+    trusty_irq_stats_t *stats;
+    uint32_t cpu, vector;
+
+    for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        for (vector = 0; vector < INT_VECTORS; vector++) {
+            stats = &int_stats[cpu].vector[vector];
+            if (!stats->handled && !stats->forwarded)
+                continue;
+            dprintf(ALWAYS, "cpu%u vec 0x%02x: handled %llu forwarded %llu "
+                    "cycles %llu\n", cpu, vector, stats->handled,
+                    stats->forwarded, stats->cycles);
+        }
+#if IRQ_FW_BATCH
+        dprintf(ALWAYS, "cpu%u forwarded %llu vectors in %llu batches\n",
+                cpu, int_fw_batch[cpu].vectors, int_fw_batch[cpu].batches);
+#endif
+    }
+
+    return 0;
 }
 
+STATIC_COMMAND_START
+STATIC_COMMAND("irqstat", "dump per-CPU interrupt statistics", &cmd_irq_stats)
+STATIC_COMMAND_END(irqstat);
+#endif
+
 /*
  * Stubs to resolve compilations errors.  These and other
  * such functions implemented under flags like SM_LIB need
@@ -162,16 +847,35 @@ void sm_intc_fiq_exit(void)
 {
 }
 
-long smc_intc_get_next_irq(smc32_args_t *args)
+/* First vector >= start with a handler installed, or -1 */
+static long find_next_vector(uint32_t start)
 {
-    long vector;
+    uint32_t word;
+    uint64_t bits;
+
+    if (start >= INT_VECTORS)
+        return -1;
+
+    word = start / 64;
+    bits = int_handler_map[word] & (UINT64_ALL_ONES << (start % 64));
 
-    for (vector = args->params[0]; vector<INT_VECTORS; vector++)
-    {
-        if (int_handler_table[vector].handler && (INT_RESCH != vector))
-            return vector;
+    while (!bits) {
+        if (++word == INT_MAP_WORDS)
+            return -1;
+        bits = int_handler_map[word];
     }
-    return -1;
+
+    return word * 64 + __builtin_ctzll(bits);
+}
+
+long smc_intc_get_next_irq(smc32_args_t *args)
+{
+    long vector = find_next_vector(args->params[0]);
+
+    if (vector == INT_RESCH)
+        vector = find_next_vector(INT_RESCH + 1);
+
+    return vector;
 }
 
 long smc_intc_request_fiq(smc32_args_t *args)
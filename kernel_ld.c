@@ -54,13 +54,13 @@ ENTRY(_start)
         *(.rela.plt)
         *(.rela.iplt)
     }
-    .rodata : ALIGN(4096) {
+    .rodata : ALIGN(KERNEL_SECTION_ALIGN) {
         __rodata_start = .;
         *(.rodata*)
         *(.gnu.linkonce.r.*)
         . = ALIGN(8);
     }
-    .data : ALIGN(4096) {
+    .data : ALIGN(KERNEL_SECTION_ALIGN) {
         __rodata_end = .;
         __data_start = .;
         *(.data .data.* .gnu.linkonce.d.*)
@@ -81,7 +81,7 @@ ENTRY(_start)
     }
     .stab : { *(.stab) }
     .stabst : { *(.stabstr) }
-    .bss : ALIGN(4096) {
+    .bss : ALIGN(KERNEL_SECTION_ALIGN) {
         __data_end = .;
         __bss_start = .;
         *(.bss*)
@@ -90,8 +90,10 @@ ENTRY(_start)
         . = ALIGN(8);
         __bss_end = .;
     }
-    . = ALIGN(4096);
+    . = ALIGN(KERNEL_SECTION_ALIGN);
     _end = .;
     _end_of_ram = . + (4*1024*1024);
+    ASSERT(_end_of_ram <= KERNEL_WINDOW_SIZE,
+           "kernel does not fit its window, build with KERNEL_LARGE_PAGES=0")
     /DISCARD/ : { *(.comment .note .eh_frame) }
 }
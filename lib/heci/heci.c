@@ -29,6 +29,8 @@
 #include <debug.h>
 #include <string.h>
 #include <kernel/vm.h>
+#include <platform/clock.h>
+#include <platform/sand.h>
 
 #include "cse_msg.h"
 #include "heci_impl.h"
@@ -41,33 +43,13 @@
 #define LOCAL_DEBUG 0
 #define DEBUG(fmt, ...) do { if(LOCAL_DEBUG) dprintf(0, "%04u: " fmt, __LINE__, ##__VA_ARGS__); } while(0)
 
-#define CPMS                19200
-#define HPET_BASE_ADDRESS   0xFED00000
-#define ClockCycles()       *((volatile uint32_t *)(hpet_mmio_base_va + 0xf0))
-
 static uint64_t cse_mmio_base_va;
-static uint64_t hpet_mmio_base_va;
-
-static void init_timer(void)
-{
-    uint32_t reg;
-    /* Clear HPET Timer 0 Lower and Upper Comparator Value. */
-    *((uint32_t *)(hpet_mmio_base_va + 0x108)) = 0;
-    *((uint32_t *)(hpet_mmio_base_va + 0x10c)) = 0;
-
-    /* Enable HPET main counter. */
-    reg = *((uint32_t *)(hpet_mmio_base_va + 0x10));
-    *((uint32_t *)(hpet_mmio_base_va + 0x10c)) = reg | 1;
-}
 
 static int wait_event(uint32_t timeout, int (*fun)(uint64_t), uint64_t arg)
 {
-    init_timer();
-    uint32_t t0 = ClockCycles();
-    volatile uint32_t elapsed;
+    uint64_t deadline = clock_now_ns() + MS_TO_NS((uint64_t)timeout);
     int res;
 
-    timeout *= CPMS;
     for (;;) {
         if (fun != NULL) {
             res = fun(arg);
@@ -75,11 +57,12 @@ static int wait_event(uint32_t timeout, int (*fun)(uint64_t), uint64_t arg)
                 return res;
         }
 
+        platform_poll_forwarded_irqs();
+
         if (!timeout)
             continue;
 
-        elapsed = ClockCycles() - t0;
-        if (elapsed >= timeout)
+        if (clock_now_ns() >= deadline)
             return -1;
     }
 
@@ -514,35 +497,22 @@ uint32_t get_attkb(uint8_t *attkb)
     return attkb_size;
 }
 
+uint64_t cse_mmio_paddr(void)
+{
+    return (uint64_t)PCI_BDF(HECI_BUS, HECI_DEVICE_NUMBER, HECI_FUNCTION_NUMBER);
+}
+
 void cse_init(void)
 {
     status_t ret;
 
     ret = vmm_alloc_physical(vmm_get_kernel_aspace(), "cse", 4096,
-        (void **)&cse_mmio_base_va, PAGE_SIZE_SHIFT,
-        (uint64_t)PCI_BDF(HECI_BUS, HECI_DEVICE_NUMBER, HECI_FUNCTION_NUMBER),
+        (void **)&cse_mmio_base_va, PAGE_SIZE_SHIFT, cse_mmio_paddr(),
         0, ARCH_MMU_FLAG_UNCACHED_DEVICE);
     if (ret)    {
         dprintf(CRITICAL, "%s: failed %d\n", __func__, ret);
         return;
     }
-#ifdef EPT_DEBUG
-    if (!ret)
-        make_ept_update_vmcall(ADD,
-        (uint64_t)PCI_BDF(HECI_BUS, HECI_DEVICE_NUMBER, HECI_FUNCTION_NUMBER), 4096);
-#endif
-
-    ret = vmm_alloc_physical(vmm_get_kernel_aspace(), "clock", 4096,
-        (void **)&hpet_mmio_base_va, PAGE_SIZE_SHIFT, HPET_BASE_ADDRESS, 0,
-        ARCH_MMU_FLAG_UNCACHED_DEVICE);
-    if (ret)    {
-        dprintf(CRITICAL, "%s: failed %d\n", __func__, ret);
-        return;
-    }
-#ifdef EPT_DEBUG
-    if (!ret)
-        make_ept_update_vmcall(ADD, HPET_BASE_ADDRESS, 4096);
-#endif
 
     return;
 }
@@ -0,0 +1,226 @@
+/*******************************************************************************
+ * Copyright (c) 2018 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+#include <debug.h>
+#include <lib/sm.h>
+#include <lib/sm/sm_err.h>
+#include <kernel/vm.h>
+#include <kernel/thread.h>
+#include <platform/sand.h>
+#ifdef EPT_DEBUG
+#include <platform/vmcall.h>
+#endif
+#include "trusty_smc_ring.h"
+
+#define SMC_RING_MAX_SIZE   (16 * PAGE_SIZE)
+
+/*
+ * Entities whose calls may be queued, normally set from rules.mk. Whoever
+ * drains the ring runs them on behalf of NS from an arbitrary CPU, so CPU,
+ * secure monitor and platform services stay out.
+ */
+#ifndef SMC_RING_ENTITIES
+#define SMC_RING_ENTITIES   (1ULL << SMC_ENTITY_TRUSTED_APP)
+#endif
+
+extern smc32_handler_t sm_fastcall_table[SMC_NUM_ENTITIES];
+extern smc32_handler_t sm_stdcall_table[SMC_NUM_ENTITIES];
+
+static trusty_smc_ring_t *smc_ring;
+static uint32_t smc_ring_mask;      /* private copy, NS may rewrite size */
+static uint32_t smc_ring_cons;
+static uint32_t smc_ring_busy;      /* set while a CPU serves the ring */
+static uint32_t smc_ring_pending;   /* a drain found the ring busy */
+
+/* Map the NS ring at pa, only once per boot */
+long smc_ring_setup(paddr_t pa, size_t size)
+{
+    void *va;
+    uint32_t entries;
+    status_t err;
+
+    if (smc_ring)
+        return SM_ERR_NOT_ALLOWED;
+
+    if (!IS_PAGE_ALIGNED(pa) || !IS_PAGE_ALIGNED(size) ||
+            !size || size > SMC_RING_MAX_SIZE)
+        return SM_ERR_INVALID_PARAMETERS;
+
+#ifdef EPT_DEBUG
+    make_ept_update_vmcall(ADD, pa, size);
+#endif
+
+    err = vmm_alloc_physical(vmm_get_kernel_aspace(), "smc_ring", size, &va,
+            PAGE_SIZE_SHIFT, pa, 0,
+            ARCH_MMU_FLAG_NS | ARCH_MMU_FLAG_PERM_NO_EXECUTE);
+    if (err) {
+        dprintf(CRITICAL, "failed (%d) to map SMC ring\n", err);
+        return SM_ERR_INTERNAL_FAILURE;
+    }
+
+    entries = ((trusty_smc_ring_t *)va)->size;
+    if (!entries || (entries & (entries - 1)) ||
+            entries > (size - sizeof(trusty_smc_ring_t)) /
+                sizeof(trusty_smc_ring_entry_t)) {
+        vmm_free_region(vmm_get_kernel_aspace(), (vaddr_t)va);
+        return SM_ERR_INVALID_PARAMETERS;
+    }
+
+    smc_ring_mask = entries - 1;
+    smc_ring_cons = ((trusty_smc_ring_t *)va)->req_prod;
+    ((trusty_smc_ring_t *)va)->rsp_prod = smc_ring_cons;
+    ((trusty_smc_ring_t *)va)->req_event = smc_ring_cons + 1;
+
+    __atomic_store_n(&smc_ring, va, __ATOMIC_RELEASE);
+
+    dprintf(INFO, "SMC ring: %u entries at 0x%lx\n", entries, pa);
+
+    return 0;
+}
+
+static int64_t smc_ring_call(uint32_t smc_nr, const uint32_t *params)
+{
+    smc32_args_t args = SMC32_ARGS_INITIAL_VALUE(args);
+
+    if (SMC_IS_SMC64(smc_nr) ||
+            !(SMC_RING_ENTITIES & (1ULL << SMC_ENTITY(smc_nr))))
+        return SM_ERR_NOT_ALLOWED;
+
+    args.smc_nr = smc_nr;
+    args.params[0] = params[0];
+    args.params[1] = params[1];
+    args.params[2] = params[2];
+
+    if (SMC_IS_FASTCALL(smc_nr))
+        return sm_fastcall_table[SMC_ENTITY(smc_nr)](&args);
+
+    return sm_stdcall_table[SMC_ENTITY(smc_nr)](&args);
+}
+
+static bool smc_ring_trylock(void)
+{
+    uint32_t idle = 0;
+
+    return __atomic_compare_exchange_n(&smc_ring_busy, &idle, 1, false,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static void smc_ring_unlock(void)
+{
+    __atomic_store_n(&smc_ring_busy, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Serve queued requests in order, at most one ring worth per call. Without
+ * stdcalls, stop at the first stdcall, it and everything behind it waits
+ * for SMC_SC_SMC_RING_RUN. Called with the ring owned.
+ */
+static void smc_ring_serve(trusty_smc_ring_t *ring, bool stdcalls)
+{
+    trusty_smc_ring_entry_t *slot;
+    uint32_t prod, budget, smc_nr, params[3];
+
+    budget = smc_ring_mask + 1;
+    do {
+        prod = __atomic_load_n(&ring->req_prod, __ATOMIC_ACQUIRE);
+        if (prod - smc_ring_cons > smc_ring_mask + 1)
+            prod = smc_ring_cons + smc_ring_mask + 1;
+
+        while (smc_ring_cons != prod && budget) {
+            slot = &ring->ring[smc_ring_cons & smc_ring_mask];
+
+            /* Read the request once, NS can still scribble over it */
+            smc_nr = __atomic_load_n(&slot->req.smc_nr, __ATOMIC_RELAXED);
+            params[0] = __atomic_load_n(&slot->req.params[0], __ATOMIC_RELAXED);
+            params[1] = __atomic_load_n(&slot->req.params[1], __ATOMIC_RELAXED);
+            params[2] = __atomic_load_n(&slot->req.params[2], __ATOMIC_RELAXED);
+
+            if (!stdcalls && !SMC_IS_FASTCALL(smc_nr))
+                return;
+
+            slot->rsp.ret = smc_ring_call(smc_nr, params);
+            slot->rsp.reserved = 0;
+
+            smc_ring_cons++;
+            budget--;
+            __atomic_store_n(&ring->rsp_prod, smc_ring_cons, __ATOMIC_RELEASE);
+        }
+
+        /* Ask for a kick on the next request, then catch a racing one */
+        ring->req_event = smc_ring_cons + 1;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    } while (budget && ring->req_prod != smc_ring_cons);
+}
+
+/*
+ * Serve the ring and release it. A drain that found the ring busy set
+ * smc_ring_pending, possibly after the owner's last look at req_prod, so
+ * check it once the ring is released and serve again if nobody else took
+ * over. Called with the ring owned.
+ */
+static void smc_ring_serve_unlock(trusty_smc_ring_t *ring, bool stdcalls)
+{
+    do {
+        __atomic_store_n(&smc_ring_pending, 0, __ATOMIC_RELAXED);
+        smc_ring_serve(ring, stdcalls);
+        smc_ring_unlock();
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    } while (__atomic_load_n(&smc_ring_pending, __ATOMIC_RELAXED) &&
+            smc_ring_trylock());
+}
+
+/*
+ * Serve queued fastcalls. Called on every entry from NS, a CPU that finds
+ * the ring busy leaves it to its owner.
+ */
+void smc_ring_drain(void)
+{
+    trusty_smc_ring_t *ring = __atomic_load_n(&smc_ring, __ATOMIC_ACQUIRE);
+    spin_lock_saved_state_t state;
+
+    if (!ring || ring->req_prod == smc_ring_cons)
+        return;
+
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    if (!smc_ring_trylock()) {
+        /* Either the owner sees the flag or the retry gets the ring */
+        __atomic_store_n(&smc_ring_pending, 1, __ATOMIC_SEQ_CST);
+        if (!smc_ring_trylock())
+            goto out;
+    }
+    smc_ring_serve_unlock(ring, false);
+out:
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+/*
+ * SMC_SC_SMC_RING_RUN, serve everything queued including stdcalls. Runs
+ * in the lib/sm stdcall thread, the only context stdcall handlers expect.
+ */
+long smc_ring_run(void)
+{
+    trusty_smc_ring_t *ring = __atomic_load_n(&smc_ring, __ATOMIC_ACQUIRE);
+
+    if (!ring)
+        return SM_ERR_NOT_ALLOWED;
+
+    /* Fastcall drains on other CPUs are short, wait them out */
+    while (!smc_ring_trylock())
+        thread_yield();
+
+    smc_ring_serve_unlock(ring, true);
+
+    return 0;
+}
@@ -18,26 +18,48 @@
 #include <lib/sm.h>
 #include <lib/sm/sm_err.h>
 #include <arch/local_apic.h>
-#include <platform/sand_defs.h>
+#include <platform/sand.h>
 #include <lk/init.h>
 #include <debug.h>
 
 /* Max entity defined as SMC_NUM_ENTITIES(64) */
 #define SMC_ENTITY_SMC_X86 63 /* Used for customized SMC calls */
 #define SMC_SC_LK_TIMER SMC_STDCALL_NR(SMC_ENTITY_SMC_X86, 0)
+#define SMC_SC_SMC_RING_SETUP SMC_STDCALL_NR(SMC_ENTITY_SMC_X86, 1)
+#define SMC_SC_SMC_RING_RUN SMC_STDCALL_NR(SMC_ENTITY_SMC_X86, 2)
+#define SMC_FC_SMC_RING_KICK SMC_FASTCALL_NR(SMC_ENTITY_SMC_X86, 0)
 
-static long self_ipi_trigger_timer_intr(void)
+static long smc_x86_stdcall(smc32_args_t *args)
 {
-    __asm__ __volatile__ ("int $0x31");
+    switch (args->smc_nr) {
+        case SMC_SC_LK_TIMER:
+            platform_timer_tick();
+            return 0;
+#if SMC_RING
+        /* params: ring paddr low, paddr high, size in bytes */
+        case SMC_SC_SMC_RING_SETUP:
+            return smc_ring_setup(((paddr_t)args->params[1] << 32) |
+                    args->params[0], args->params[2]);
+        /* Serve queued stdcalls, and whatever was queued behind them */
+        case SMC_SC_SMC_RING_RUN:
+            return smc_ring_run();
+#endif
+        default:
+            return SM_ERR_UNDEFINED_SMC;
+    }
 
     return 0;
 }
 
-static long smc_x86_stdcall(smc32_args_t *args)
+static long smc_x86_fastcall(smc32_args_t *args)
 {
     switch (args->smc_nr) {
-        case SMC_SC_LK_TIMER:
-            return self_ipi_trigger_timer_intr();
+#if SMC_RING
+        /* The ring itself is served on entry, see sm_sched_nonsecure() */
+        case SMC_FC_SMC_RING_KICK:
+            smc_ring_drain();
+            return 0;
+#endif
         default:
             return SM_ERR_UNDEFINED_SMC;
     }
@@ -46,6 +68,7 @@ static long smc_x86_stdcall(smc32_args_t *args)
 }
 
 static smc32_entity_t smc_x86_entity= {
+    .fastcall_handler = smc_x86_fastcall,
     .stdcall_handler = smc_x86_stdcall,
 };
 
@@ -19,6 +19,8 @@
 #include <platform/lpss_spi.h>
 #include <platform/spi.h>
 #include <platform/sand_defs.h>
+#include <platform/clock.h>
+#include <platform/sand.h>
 
 static struct spi_tran_data spi_drv_data;
 
@@ -29,26 +31,26 @@ static inline struct spi_tran_data *dev_get_drvdata(void)
 
 static inline int check_tx_fifo(void)
 {
-
-    int timeout = TIMEOUT;
+    uint64_t deadline = clock_now_ns() + MS_TO_NS(SPI_TIMEOUT_MS);
 
     while (!(lpss_spi_read(SPI_SR) & SPI_SR_TNF)) {
-        if (!--timeout)
-            return ERR_TIMED_OUT ;
+        if (clock_now_ns() >= deadline)
+            return ERR_TIMED_OUT;
         __asm__ __volatile__("pause":::"memory");
+        platform_poll_forwarded_irqs();
     }
     return NO_ERROR;
 }
 
 static inline int check_rx_fifo(void)
 {
-
-    int timeout = TIMEOUT;
+    uint64_t deadline = clock_now_ns() + MS_TO_NS(SPI_TIMEOUT_MS);
 
     while (!(lpss_spi_read(SPI_SR) & SPI_SR_RNE)) {
-        if (!--timeout)
-            return ERR_TIMED_OUT ;
+        if (clock_now_ns() >= deadline)
+            return ERR_TIMED_OUT;
         __asm__ __volatile__("pause":::"memory");
+        platform_poll_forwarded_irqs();
     }
     return NO_ERROR;
 }
@@ -174,15 +176,19 @@ void spi_set_cs(uint8_t flag)
     lpss_spi_write(SPI_CC, val);
 }
 
+/* Return non-zero once the bus goes idle, zero on timeout */
 static int spi_check_busy(void)
 {
-    int timeout = TIMEOUT;
+    uint64_t deadline = clock_now_ns() + MS_TO_NS(SPI_TIMEOUT_MS);
 
     do {
         __asm__ __volatile__("pause":::"memory");
-    } while ((lpss_spi_read(SPI_SR) & SPI_SR_BSY) && --timeout);
+        if (!(lpss_spi_read(SPI_SR) & SPI_SR_BSY))
+            return 1;
+        platform_poll_forwarded_irqs();
+    } while (clock_now_ns() < deadline);
 
-    return timeout;
+    return 0;
 }
 
 void spi_init(void)
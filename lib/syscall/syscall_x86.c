@@ -14,12 +14,16 @@
  * limitations under the License.
  *******************************************************************************/
 
+#include <stdlib.h>
 #include <string.h>
 #include <lib/trusty/trusty_app.h>
 
 #include <kernel/usercopy.h>
 #include <kernel/mutex.h>
+#include <kernel/vm.h>
+#include <lk/init.h>
 #include <platform/sand.h>
+#include <platform/clock.h>
 #include <uapi/err.h>
 #ifdef SPI_CONTROLLER
 #include <platform/spi.h>
@@ -29,6 +33,7 @@
 #define GET_SEED           (1<<1)
 #define GET_ATTKB          (1<<2)
 #define GET_RPMB_KEY       (1<<3)
+#define GET_IRQ_STATS      (1<<4)
 
 typedef struct ta_permission {
 	uuid_t uuid;
@@ -77,7 +82,11 @@ static uint32_t get_ta_permission(void)
 	ta_permission_t ta_permission_matrix[] = {
 		{HWCRYPTO_SRV_APP_UUID, GET_SEED | GET_RPMB_KEY},
 		{KEYMASTER_SRV_APP_UUID, GET_ATTKB},
-		{SECURE_STORAGE_SERVER_APP_UUID, GET_BASIC_INFO}
+		{SECURE_STORAGE_SERVER_APP_UUID, GET_BASIC_INFO},
+#ifdef IRQ_STATS_APP_UUID
+		/* Interrupt counts leak timing of other TAs, debug builds only */
+		{IRQ_STATS_APP_UUID, GET_IRQ_STATS},
+#endif
 		};
 	uint i;
 
@@ -201,6 +210,85 @@ long sys_get_device_info(user_addr_t info)
 	return NO_ERROR;
 }
 
+/*
+ * Map the kernel time page read-only into the calling app, once per app,
+ * and return its user address. The address is kept in app local storage
+ * so it goes away with the app and its address space.
+ */
+static uint time_page_als_slot;
+static mutex_t time_page_lock = MUTEX_INITIAL_VALUE(time_page_lock);
+
+static void time_page_init(uint level)
+{
+	int slot = trusty_als_alloc_slot();
+
+	if (slot <= 0)
+		panic("failed (%d) to allocate time page als slot\n", slot);
+
+	time_page_als_slot = slot;
+}
+
+LK_INIT_HOOK(time_page, time_page_init, LK_INIT_LEVEL_APPS - 1);
+
+long sys_get_time_page(user_addr_t page)
+{
+	trusty_app_t *trusty_app = current_trusty_thread()->app;
+	user_addr_t va;
+	void *ptr = NULL;
+	long ret = NO_ERROR;
+
+	mutex_acquire(&time_page_lock);
+
+	va = (user_addr_t)(uintptr_t)trusty_als_get(trusty_app,
+			time_page_als_slot);
+	if (va)
+		goto out;
+
+	ret = vmm_alloc_physical(trusty_app->aspace, "time_page", PAGE_SIZE,
+			&ptr, PAGE_SIZE_SHIFT, clock_time_page_paddr(), 0,
+			ARCH_MMU_FLAG_CACHED | ARCH_MMU_FLAG_PERM_USER |
+			ARCH_MMU_FLAG_PERM_RO | ARCH_MMU_FLAG_PERM_NO_EXECUTE);
+	if (ret != NO_ERROR) {
+		dprintf(CRITICAL, "failed (%ld) to map time page\n", ret);
+		goto out;
+	}
+
+	va = (user_addr_t)(uintptr_t)ptr;
+	trusty_als_set(trusty_app, time_page_als_slot, ptr);
+
+out:
+	mutex_release(&time_page_lock);
+
+	if (ret != NO_ERROR)
+		return ret;
+
+	return copy_to_user(page, &va, sizeof(va));
+}
+
+long sys_get_irq_stats(uint32_t cpu, uint32_t first, user_addr_t stats,
+		uint32_t count)
+{
+	trusty_irq_stats_t *buf;
+	long ret;
+
+	if (!(get_ta_permission() & GET_IRQ_STATS))
+		return ERR_NOT_ALLOWED;
+
+	if (!count || count > TRUSTY_IRQ_VECTORS)
+		return ERR_INVALID_ARGS;
+
+	buf = malloc(count * sizeof(trusty_irq_stats_t));
+	if (!buf)
+		return ERR_NO_MEMORY;
+
+	ret = platform_get_irq_stats(cpu, first, buf, count);
+	if (ret == NO_ERROR)
+		ret = copy_to_user(stats, buf, count * sizeof(trusty_irq_stats_t));
+
+	free(buf);
+	return ret;
+}
+
 #ifdef SPI_CONTROLLER
 //system call for fingerprint
 void sys_trusty_spi_init(void)
@@ -15,6 +15,8 @@
  */
 
 #define __NR_get_device_info				0xa0
+#define __NR_get_time_page				0xa6
+#define __NR_get_irq_stats				0xa7
 #ifdef SPI_CONTROLLER
 #define __NR_trusty_spi_init 				0xa1
 #define __NR_trusty_spi_set_cs				0xa2
@@ -27,8 +29,13 @@
 
 __BEGIN_CDECLS
 #include "trusty_device_info.h"
+#include "trusty_time_page.h"
+#include "trusty_irq_stats.h"
 
 long get_device_info (trusty_device_info_t *info);
+long get_time_page(const trusty_time_page_t **page);
+long get_irq_stats(uint32_t cpu, uint32_t first, trusty_irq_stats_t *stats,
+		uint32_t count);
 #ifdef SPI_CONTROLLER
 void trusty_spi_init(void);
 void trusty_spi_set_cs(uint8_t flag);
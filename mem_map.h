@@ -26,3 +26,16 @@
 /* LK code entry offset to the LK memory start */
 /* keep 1 PAGE from start, since VA/PA start from this point */
 #define TRUSTY_ENTRY_OFFSET 0x1000
+
+/* Size of the window the kernel image and its early heap are loaded in */
+#define KERNEL_WINDOW_SIZE 0x1000000
+
+/*
+ * Alignment of .rodata, .data and .bss. platform_update_pagetable() maps
+ * every 2MB span a section fully covers with a large page. A 2MB alignment,
+ * KERNEL_LARGE_PAGES=1 in rules.mk, extends that to whole sections at the
+ * cost of up to 8MB of padding, kernel_ld.c checks the image still fits.
+ */
+#ifndef KERNEL_SECTION_ALIGN
+#define KERNEL_SECTION_ALIGN 4096
+#endif
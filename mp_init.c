@@ -60,27 +60,6 @@ inline static bool is_ap_wkup_addrr_available(uint32_t addr)
         return false;
 }
 
-#define TSC_PER_MS 2000000
-static void wait_us(uint64_t us)
-{
-    uint64_t end_tsc;
-    uint64_t val;
-    uint32_t low, high;
-
-    rdtsc(low, high);
-    val = (uint64_t)((uint64_t)high <<32 | (uint64_t)low);
-
-    end_tsc = val + (us * TSC_PER_MS / 1000ULL);
-
-    while (val < end_tsc)
-    {
-        __asm__ __volatile__("pause");
-        rdtsc(low, high);
-        val = (uint64_t)((uint64_t)high <<32 | (uint64_t)low);
-    }
-}
-
-
 extern uintptr_t real_run_addr;
 /*
  * GDTR layout in start16.S
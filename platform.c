@@ -13,17 +13,23 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  *******************************************************************************/
+#include <err.h>
 #include <string.h>
 #include <assert.h>
 #include <arch/x86/mmu.h>
 #include <arch/x86.h>
 #include <arch/local_apic.h>
+#include <arch/mp.h>
+#include <kernel/mp.h>
 #include <kernel/vm.h>
 #include <platform/sand.h>
 #include <platform/vmcall.h>
+#include <platform/clock.h>
+#include <platform/static_call.h>
 #ifdef SPI_CONTROLLER
 #include <platform/lpss_spi.h>
 #endif
+#include "mem_map.h"
 
 #define GET_STEPPING_ID(val)    ((val) & 0xF)
 #define GET_MODEL(val)          (((val) >> 4) & 0xF)
@@ -48,14 +54,6 @@ extern void init_uart(void);
 /* Store physical address LK is located. */
 uintptr_t entry_phys = 0;
 
-/* For 16MB memory mapping */
-map_addr_t pde_kernel[NO_OF_PT_ENTRIES] __ALIGNED(PAGE_SIZE);
-/* Acutally needs 8 entries only, 1 more for unalignment mapping */
-map_addr_t pte_kernel[NO_OF_PT_ENTRIES * 9] __ALIGNED(PAGE_SIZE);
-
-/* a big pile of page tables needed to map 512GB of memory into kernel space using 2MB pages */
-map_addr_t linear_map_pdp_512[(512ULL*GB) / (2*MB)] __ALIGNED(PAGE_SIZE);
-
 device_sec_info_t *g_sec_info = NULL;
 
 enum {
@@ -64,29 +62,68 @@ enum {
     VMM_SUPPORTED_NUM
 } vmm_id_t;
 
-static const char *vmm_signature[] = {
-    [VMM_ID_EVMM] = "EVMMEVMMEVMM",
-    [VMM_ID_ACRN] = "ACRNACRNACRN"
+#define CPUID_LEAF_VMM_SIGNATURE    0x40000000
+#define CPUID_LEAF_VMM_FEATURES     0x40000001
+
+/* What differs between the VMMs Trusty runs on */
+struct vmm_ops {
+    const char *signature;
+    void (*smc_vmcall)(smc64_args_t *args, long ret);
+    long (*register_pvclock)(paddr_t pa);
+};
+
+static const struct vmm_ops vmm_ops_table[] = {
+    [VMM_ID_EVMM] = {
+        .signature = "EVMMEVMMEVMM",
+        .smc_vmcall = make_smc_vmcall_evmm,
+        .register_pvclock = make_pvclock_vmcall_evmm,
+    },
+    [VMM_ID_ACRN] = {
+        .signature = "ACRNACRNACRN",
+        .smc_vmcall = make_smc_vmcall_acrn,
+        .register_pvclock = make_pvclock_vmcall_acrn,
+    },
 };
 
+static int vmm_id = -1;
+static uint32_t vmm_features;
+
 static inline int detect_vmm(void)
 {
-    uint32_t signature[3];
+    uint32_t max_leaf, signature[3], features;
     int i;
 
     __asm__ __volatile__ (
         "cpuid\n\t"
-        : "=b" (signature[0]),
+        : "=a" (max_leaf),
+          "=b" (signature[0]),
           "=c" (signature[1]),
           "=d" (signature[2])
-        : "a" (0x40000000)
+        : "a" (CPUID_LEAF_VMM_SIGNATURE)
         : "cc");
 
     for (i=0; i<VMM_SUPPORTED_NUM; i++) {
-        if (!memcmp(vmm_signature[i], signature, 12))
-            return i;
+        if (!memcmp(vmm_ops_table[i].signature, signature, 12))
+            break;
+    }
+    if (i == VMM_SUPPORTED_NUM)
+        return -1;
+
+    if (max_leaf >= CPUID_LEAF_VMM_FEATURES) {
+        __asm__ __volatile__ (
+            "cpuid\n\t"
+            : "=a" (features)
+            : "a" (CPUID_LEAF_VMM_FEATURES)
+            : "ebx", "ecx", "edx", "cc");
+        vmm_features = features;
     }
-    return -1;
+
+    return i;
+}
+
+bool vmm_has_feature(uint32_t feature)
+{
+    return (vmm_features & feature) == feature;
 }
 
 #ifdef WITH_KERNEL_VM
@@ -95,7 +132,7 @@ struct mmu_initial_mapping mmu_initial_mappings[] = {
     {
         .phys = MEMBASE + KERNEL_LOAD_OFFSET,
         .virt = KERNEL_BASE + KERNEL_LOAD_OFFSET,
-        .size = 16*MB,
+        .size = KERNEL_WINDOW_SIZE,
         .flags = MMU_INITIAL_MAPPING_TEMPORARY,
         .name = "kernel"
     },
@@ -128,6 +165,190 @@ static void heap_arena_init(void)
 }
 #endif
 
+#define LARGE_PAGE_SIZE  (2*MB)
+#define LARGE_PAGE_FRAME (X86_PG_FRAME & ~((map_addr_t)LARGE_PAGE_SIZE - 1))
+/* PAT is bit 12 of a 2MB entry and bit 7 of a 4KB one */
+#define LARGE_PAGE_PAT   (1ULL << 12)
+#define PAGE_PAT         (1ULL << 7)
+
+/*
+ * Return the page directory entry mapping va, or NULL if no page directory
+ * covers it yet.
+ */
+static map_addr_t *pagetable_get_pde(map_addr_t pml4_table, vaddr_t va)
+{
+    map_addr_t *table = (map_addr_t *)pml4_table;
+    map_addr_t entry;
+
+    entry = table[(va >> PML4_SHIFT) & ((1 << ADDR_OFFSET) - 1)];
+    if (!(entry & X86_MMU_PG_P))
+        return NULL;
+
+    table = (map_addr_t *)paddr_to_kvaddr(entry & X86_PG_FRAME);
+    entry = table[(va >> PDP_SHIFT) & ((1 << ADDR_OFFSET) - 1)];
+    if (!(entry & X86_MMU_PG_P) || (entry & X86_MMU_PG_PS))
+        return NULL;
+
+    table = (map_addr_t *)paddr_to_kvaddr(entry & X86_PG_FRAME);
+    return &table[(va >> PD_SHIFT) & ((1 << ADDR_OFFSET) - 1)];
+}
+
+/*
+ * Replace the 2MB page at *pde by a page table mapping the same memory with
+ * 4KB pages, so part of it can be remapped. start.S maps the kernel window
+ * and the low linear map with 2MB pages.
+ */
+static status_t pagetable_split_pde(map_addr_t *pde)
+{
+    map_addr_t entry = *pde;
+    map_addr_t frame = entry & LARGE_PAGE_FRAME;
+    map_addr_t flags = entry & ~(X86_PG_FRAME | X86_MMU_PG_PS);
+    map_addr_t *pt;
+    uint i;
+
+    if (!(entry & X86_MMU_PG_P) || !(entry & X86_MMU_PG_PS))
+        return NO_ERROR;
+
+    if (entry & LARGE_PAGE_PAT)
+        flags |= PAGE_PAT;
+
+    pt = pmm_alloc_kpages(1, NULL);
+    if (!pt)
+        return ERR_NO_MEMORY;
+
+    for (i = 0; i < NO_OF_PT_ENTRIES; i++)
+        pt[i] = (frame + i * PAGE_SIZE) | flags;
+
+    *pde = vaddr_to_paddr(pt) | X86_KERNEL_PD_FLAGS;
+    return NO_ERROR;
+}
+
+/*
+ * x86_mmu_map_range() for a range that may sit under 2MB pages, those are
+ * split into 4KB pages first.
+ */
+static void map_range_small(map_addr_t pml4_table, struct map_range *range,
+        arch_flags_t access)
+{
+    vaddr_t cur = ROUNDDOWN(range->start_vaddr, LARGE_PAGE_SIZE);
+    vaddr_t end = range->start_vaddr + range->size;
+    map_addr_t *pde;
+
+    for (; cur < end; cur += LARGE_PAGE_SIZE) {
+        pde = pagetable_get_pde(pml4_table, cur);
+        if (pde && pagetable_split_pde(pde) != NO_ERROR)
+            panic("Failed to split the large page at 0x%lx!\n", cur);
+    }
+
+    x86_mmu_map_range(pml4_table, range, access);
+}
+
+/*
+ * Flags of a 2MB entry mapping pa at va with access, as translated by
+ * x86_mmu_map_range() itself: it maps the first 4KB and its PTE bits are
+ * lifted to the PDE, PAT moving from bit 7 to bit 12. A 2MB page split
+ * for this is put back. Returns 0 if va has no page directory.
+ */
+static map_addr_t large_page_flags(map_addr_t pml4_table, vaddr_t va,
+        paddr_t pa, arch_flags_t access)
+{
+    struct map_range page = {
+        .start_vaddr = va,
+        .start_paddr = pa,
+        .size = PAGE_SIZE,
+    };
+    map_addr_t *pde = pagetable_get_pde(pml4_table, va);
+    map_addr_t saved, pte, flags;
+    map_addr_t *pt;
+
+    if (!pde)
+        return 0;
+
+    saved = *pde;
+    if (pagetable_split_pde(pde) != NO_ERROR)
+        return 0;
+
+    x86_mmu_map_range(pml4_table, &page, access);
+
+    pt = (map_addr_t *)paddr_to_kvaddr(*pde & X86_PG_FRAME);
+    pte = pt[(va >> PT_SHIFT) & ((1 << ADDR_OFFSET) - 1)];
+
+    if (saved & X86_MMU_PG_PS) {
+        *pde = saved;
+        pmm_free_kpages(pt, 1);
+    }
+
+    if (!(pte & X86_MMU_PG_P))
+        return 0;
+
+    flags = (pte & ~(X86_PG_FRAME | PAGE_PAT)) | X86_MMU_PG_PS;
+    if (pte & PAGE_PAT)
+        flags |= LARGE_PAGE_PAT;
+
+    return flags;
+}
+
+/*
+ * Like x86_mmu_map_range(), but every 2MB span the range fully covers is
+ * mapped with a single large page. Only the unaligned head and tail fall
+ * back to 4KB pages. Large pages need VA and PA to share their offset in
+ * 2MB, otherwise the whole range is mapped with 4KB pages.
+ *
+ * Replaced page tables are not freed, they are the static ones from
+ * start.S or the few split above.
+ */
+static void map_range_large(map_addr_t pml4_table, struct map_range *range,
+        arch_flags_t access)
+{
+    vaddr_t va = range->start_vaddr;
+    paddr_t pa = range->start_paddr;
+    vaddr_t end = va + range->size;
+    vaddr_t lp_start = ROUNDUP(va, LARGE_PAGE_SIZE);
+    vaddr_t lp_end = ROUNDDOWN(end, LARGE_PAGE_SIZE);
+    struct map_range edge;
+    map_addr_t flags = 0;
+    map_addr_t *pde;
+    vaddr_t cur;
+
+    if (((va ^ pa) & (LARGE_PAGE_SIZE - 1)) || lp_start >= lp_end) {
+        map_range_small(pml4_table, range, access);
+        return;
+    }
+
+    if (lp_start > va) {
+        edge.start_vaddr = va;
+        edge.start_paddr = pa;
+        edge.size = lp_start - va;
+        map_range_small(pml4_table, &edge, access);
+    }
+
+    for (cur = lp_start; cur < lp_end; cur += LARGE_PAGE_SIZE) {
+        struct map_range chunk = {
+            .start_vaddr = cur,
+            .start_paddr = pa + (cur - va),
+            .size = LARGE_PAGE_SIZE,
+        };
+
+        if (!flags)
+            flags = large_page_flags(pml4_table, cur, chunk.start_paddr,
+                    access);
+
+        pde = pagetable_get_pde(pml4_table, cur);
+        if (!pde || !flags) {
+            x86_mmu_map_range(pml4_table, &chunk, access);
+            continue;
+        }
+        *pde = chunk.start_paddr | flags;
+    }
+
+    if (end > lp_end) {
+        edge.start_vaddr = lp_end;
+        edge.start_paddr = pa + (lp_end - va);
+        edge.size = end - lp_end;
+        map_range_small(pml4_table, &edge, access);
+    }
+}
+
 static void platform_update_pagetable(void)
 {
     struct map_range range;
@@ -140,7 +361,7 @@ static void platform_update_pagetable(void)
     range.start_paddr = (uint64_t)vaddr_to_paddr((void *) & __code_start);
     range.size =
         ((map_addr_t) & __code_end) - ((map_addr_t) & __code_start);
-    x86_mmu_map_range(pml4_table, &range, access);
+    map_range_large(pml4_table, &range, access);
 
     /* kernel data section mapping */
     access = 0;
@@ -151,7 +372,7 @@ static void platform_update_pagetable(void)
     range.start_paddr = (uint64_t)vaddr_to_paddr((void *) & __data_start);
     range.size =
         ((map_addr_t) & __data_end) - ((map_addr_t) & __data_start);
-    x86_mmu_map_range(pml4_table, &range, access);
+    map_range_large(pml4_table, &range, access);
 
     /* kernel rodata section mapping */
     access = ARCH_MMU_FLAG_PERM_RO;
@@ -162,7 +383,7 @@ static void platform_update_pagetable(void)
     range.start_paddr = (uint64_t)vaddr_to_paddr((void *) & __rodata_start);
     range.size =
         ((map_addr_t) & __rodata_end) - ((map_addr_t) & __rodata_start);
-    x86_mmu_map_range(pml4_table, &range, access);
+    map_range_large(pml4_table, &range, access);
 
     /* kernel bss section and kernel heap mappings */
     access = 0;
@@ -172,21 +393,35 @@ static void platform_update_pagetable(void)
     range.start_vaddr =  (map_addr_t) & __bss_start;
     range.start_paddr = (uint64_t)vaddr_to_paddr((void *) & __bss_start);
     range.size = ((map_addr_t) &__bss_end) - ((map_addr_t) & __bss_start);
-    x86_mmu_map_range(pml4_table, &range, access);
+    map_range_large(pml4_table, &range, access);
 
     /* Mapping lower boundary to kernel start */
     access = ARCH_MMU_FLAG_PERM_NO_EXECUTE;
     range.start_vaddr = (map_addr_t)paddr_to_kvaddr(mmu_initial_mappings[0].phys);
     range.start_paddr = mmu_initial_mappings[0].phys;
     range.size = vaddr_to_paddr((void *)&_start) - mmu_initial_mappings[0].phys;
-    x86_mmu_map_range(pml4_table, &range, access | ARCH_MMU_FLAG_NS);
+    map_range_large(pml4_table, &range, access | ARCH_MMU_FLAG_NS);
 
     /* Mapping upper boundary to target maxium memory size */
     map_addr_t va = (map_addr_t)&_end;
     range.start_vaddr = (map_addr_t)PAGE_ALIGN(va);
     range.start_paddr = (uint64_t)vaddr_to_paddr((void *)PAGE_ALIGN(va));
     range.size = ((map_addr_t)(mmu_initial_mappings[0].phys + mmu_initial_mappings[0].size) - range.start_paddr);
-    x86_mmu_map_range(pml4_table, &range, access | ARCH_MMU_FLAG_NS);
+    map_range_large(pml4_table, &range, access | ARCH_MMU_FLAG_NS);
+
+    /*
+     * Drop the 4KB translations replaced by large pages, global ones too.
+     * This only flushes the local TLB, which is enough since platform_init()
+     * runs before x86_mp_init() wakes up the APs.
+     */
+    DEBUG_ASSERT(!(mp_get_active_mask() & ~(1U << arch_curr_cpu_num())));
+    uint64_t cr4 = x86_get_cr4();
+    if (cr4 & X86_CR4_PGE) {
+        x86_set_cr4(cr4 & ~X86_CR4_PGE);
+        x86_set_cr4(cr4);
+    } else {
+        x86_set_cr3(x86_get_cr3());
+    }
 }
 
 void platform_init_mmu_mappings(void)
@@ -203,21 +438,35 @@ void clear_sensitive_data(void)
     }
 }
 
+status_t vmm_register_pvclock(paddr_t pa)
+{
+    if (vmm_id < 0 || !vmm_has_feature(VMM_FEATURE_PVCLOCK))
+        return ERR_NOT_SUPPORTED;
+
+    return vmm_ops_table[vmm_id].register_pvclock(pa) ? ERR_GENERIC : NO_ERROR;
+}
+
+/* Physical address of an object in the kernel image, valid before VM init */
+paddr_t platform_kernel_paddr(const void *va)
+{
+    return (vaddr_t)va - mmu_initial_mappings[0].virt + mmu_initial_mappings[0].phys;
+}
+
 void smc_init(void)
 {
-    int vmm_id;
+    const struct vmm_ops *ops;
 
-    vmm_id = detect_vmm();
-    if (vmm_id == VMM_ID_EVMM) {
-        make_smc_vmcall = make_smc_vmcall_evmm;
-    } else if (vmm_id == VMM_ID_ACRN) {
-        make_smc_vmcall = make_smc_vmcall_acrn;
-    } else {
+    if (vmm_id < 0) {
         dprintf(CRITICAL, "Trusty is not yet supported on Current VMM!\n");
         ASSERT(0);
+        return;
     }
 
-    dprintf(INFO, "Detected VMM: signature=%s\n", vmm_signature[vmm_id]);
+    ops = &vmm_ops_table[vmm_id];
+    static_call_update(make_smc_vmcall, ops->smc_vmcall);
+
+    dprintf(INFO, "Detected VMM: signature=%s features=0x%x\n",
+            ops->signature, vmm_features);
 }
 
 /*
@@ -236,14 +485,45 @@ static void platform_heap_init(void)
     mmu_initial_mappings[1].virt += entry_phys;
 }
 
+/*
+ * The VMM only exposes MMIO that Trusty asked for. Ask for everything boot
+ * needs in one hypercall, the flush is left to the end of boot anyway.
+ */
+static void platform_ept_map_boot_mmio(void)
+{
+#ifdef EPT_DEBUG
+    ept_update_desc_t desc[3];
+    uint32_t count = 0;
+
+    desc[count++] = (ept_update_desc_t){ ADD, HPET_BASE_ADDRESS, PAGE_SIZE };
+#if PRINT_USE_MMIO
+    desc[count++] = (ept_update_desc_t){ ADD, uart_mmio_paddr(), PAGE_SIZE };
+#endif
+#if ATTKB_HECI
+    desc[count++] = (ept_update_desc_t){ ADD, cse_mmio_paddr(), PAGE_SIZE };
+#endif
+
+    make_ept_batch_update_vmcall(desc, count);
+#endif
+}
+
 void platform_early_init(void)
 {
     /* initialize the heap */
     platform_heap_init();
 
+    /* VMM features decide which hypercalls the rest of boot may use */
+    vmm_id = detect_vmm();
+
     /* initialize the interrupt controller */
     platform_init_interrupts();
 
+    /* open up boot time MMIO before anyone touches it */
+    platform_ept_map_boot_mmio();
+
+    /* calibrate TSC before anyone asks for current time */
+    platform_init_clock();
+
     /* initialize the timer */
     platform_init_timer();
 
@@ -259,22 +539,6 @@ void platform_early_init(void)
     local_apic_init();
 }
 
-static inline void __cpuid(uint64_t cpu_info[4], uint64_t leaf, uint64_t subleaf)
-{
-    __asm__ __volatile__ (
-        "pushq %%rbx;" /* save the ebx */
-        "cpuid;"
-        "mov %%rbx, %1;" /* save what cpuid just put in ebx */
-        "popq %%rbx;" /* restore the old ebx */
-        : "=a" (cpu_info[0]),
-          "=r" (cpu_info[1]),
-          "=c" (cpu_info[2]),
-          "=d" (cpu_info[3])
-        : "a" (leaf), "c" (subleaf)
-        : "cc"
-        );
-}
-
 static inline bool is_sep_support(uint64_t val)
 {
     return !!BITMAP_GET(val, SEP_BIT);
@@ -24,6 +24,54 @@ WITH_SM_WALL=1
 GLOBAL_DEFINES += \
 	    PLATFORM_HAS_DYNAMIC_TIMER=1
 
+# Allowed lateness (ms) of secure timers, lets close deadlines share one
+# NS timer fire. 0 disables coalescing.
+TIMER_SLACK_MS ?= 0
+GLOBAL_DEFINES += \
+	    PLATFORM_TIMER_SLACK_MS=$(TIMER_SLACK_MS)
+
+# Return to NS once per burst of foreign interrupts instead of once per
+# vector, see platform_flush_forwarded_irqs()
+IRQ_FW_BATCH ?= 0
+ifeq ($(IRQ_FW_BATCH), 1)
+GLOBAL_DEFINES += \
+	    IRQ_FW_BATCH=1
+endif
+
+# Per-CPU count and latency histograms of SMCs, see 'smcprof'
+SMC_PROFILE ?= 0
+ifeq ($(SMC_PROFILE), 1)
+GLOBAL_DEFINES += \
+	    SMC_PROFILE=1
+endif
+
+# Let NS queue fastcalls in a shared ring served on every SMC entry
+SMC_RING ?= 0
+ifeq ($(SMC_RING), 1)
+GLOBAL_DEFINES += \
+	    SMC_RING=1
+endif
+
+# Mask of SMC entities whose calls may be queued in the SMC ring, one bit
+# per entity number. Meant for the Trusty OS virtio/IPC stdcalls (entity
+# 50), which lib/trusty registers, and for trusted app services (entity
+# 48). CPU, secure monitor and platform entities must stay out: the ring
+# runs calls on behalf of NS from whichever CPU drains it.
+SMC_RING_ENTITIES ?= 0x0005000000000000
+ifeq ($(SMC_RING), 1)
+GLOBAL_DEFINES += \
+	    SMC_RING_ENTITIES=$(SMC_RING_ENTITIES)ULL
+endif
+
+# Align kernel sections to 2MB so they are mapped with large pages as a
+# whole. Only for images small enough to absorb the padding in the 16MB
+# kernel window, the link fails otherwise.
+KERNEL_LARGE_PAGES ?= 0
+ifeq ($(KERNEL_LARGE_PAGES), 1)
+GLOBAL_DEFINES += \
+	    KERNEL_SECTION_ALIGN=0x200000
+endif
+
 ifneq (,$(RUNTIME_MEM_BASE))
 GLOBAL_DEFINES += \
 	    RT_MEM_BASE=$(RUNTIME_MEM_BASE)
@@ -46,6 +94,9 @@ MODULE_SRCS += \
 	$(LOCAL_DIR)/interrupts.c \
 	$(LOCAL_DIR)/platform.c \
 	$(LOCAL_DIR)/timer.c \
+	$(LOCAL_DIR)/clock.c \
+	$(LOCAL_DIR)/defer.c \
+	$(LOCAL_DIR)/static_call.c \
 	$(LOCAL_DIR)/debug.c \
 	$(LOCAL_DIR)/entry.c \
 	$(LOCAL_DIR)/vmcall.c \
@@ -60,6 +111,11 @@ MODULE_SRCS += \
 	$(LOCAL_DIR)/lib/spi/spi.c
 endif
 
+ifeq ($(SMC_RING), 1)
+MODULE_SRCS += \
+	$(LOCAL_DIR)/lib/smc/smc_ring.c
+endif
+
 ifeq ($(ATTKB_HECI), 1)
 MODULE_SRCS += \
 	$(LOCAL_DIR)/lib/heci/heci.c
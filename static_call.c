@@ -0,0 +1,48 @@
+/*******************************************************************************
+ * Copyright (c) 2018 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *******************************************************************************/
+#include <debug.h>
+#include <kernel/vm.h>
+#include <platform/sand.h>
+#include <platform/static_call.h>
+
+#define JMP_REL32_OPCODE    0xe9
+
+void static_call_update_addr(void *tramp, void *target)
+{
+    int64_t rel = (int64_t)target - ((int64_t)tramp + STATIC_CALL_INSN_SIZE);
+    uint64_t *insn;
+    uint64_t val, info[4];
+    paddr_t pa;
+
+    if (((vaddr_t)tramp & 7) || rel != (int32_t)rel)
+        panic("static call %p: cannot reach %p\n", tramp, target);
+
+    /* Kernel text is not writable, patch through the linear mapping */
+    pa = vaddr_to_paddr(tramp);
+    insn = pa ? paddr_to_kvaddr(pa) : NULL;
+    if (!insn)
+        panic("static call %p: no writable alias\n", tramp);
+
+    val = __atomic_load_n(insn, __ATOMIC_RELAXED);
+    if ((val & 0xff) != JMP_REL32_OPCODE)
+        panic("static call %p: not a trampoline\n", tramp);
+
+    val = (val & ~(0xffffffffULL << 8)) | ((uint64_t)(uint32_t)rel << 8);
+    __atomic_store_n(insn, val, __ATOMIC_RELEASE);
+
+    /* Serialize so this CPU does not execute a stale prefetched jump */
+    __cpuid(info, 0, 0);
+}
@@ -14,17 +14,25 @@
  * limitations under the License.
  *******************************************************************************/
 #include <err.h>
+#include <arch/defines.h>
 #include <arch/arch_ops.h>
 #include <arch/local_apic.h>
 #include <platform/sand.h>
 #include <platform/interrupts.h>
 #include <platform/timer.h>
+#include <platform/clock.h>
+#include <kernel/thread.h>
+#include <kernel/spinlock.h>
 #include <debug.h>
 
 #if WITH_SM_WALL
 #include <lib/sm.h>
 #include <lib/sm/sm_wall.h>
 #include <lk/init.h>
+#include <platform/histogram.h>
+#if WITH_LIB_CONSOLE
+#include <lib/console.h>
+#endif
 
 /* Backup timer definition aligns to sec_timer_state in smcall
  *
@@ -38,12 +46,27 @@ typedef struct bakcup_timer_t {
     uint64_t cv_ns;
 }backup_timer;
 
-#define MS_TO_NS(ms) ((ms)*1000000ULL)
-backup_timer back_timer;
+/*
+ * Each CPU publishes its own deadline through its per-CPU wall item,
+ * pad the state to a cache line so CPUs never share it.
+ */
+struct percpu_backup_timer {
+    backup_timer timer;
+    uint64_t armed_ns;      /* absolute deadline NS will fire at, 0 if none */
+    uint64_t published;     /* deadlines handed to NS */
+    uint64_t coalesced;     /* requests merged into an armed deadline */
+    uint64_t early;         /* ticks before the armed deadline */
+    uint64_t late;          /* ticks at least TIMER_LATE_NS past it */
+    uint64_t overlapped;    /* NS interrupts on INT_PIT forwarded back */
+    struct log2_hist latency;   /* tick entry - armed deadline, in us */
+} __ALIGNED(CACHE_LINE);
+
+/* A tick this far behind its deadline counts as a miss */
+#define TIMER_LATE_NS   MS_TO_NS(1ULL)
+
+static struct percpu_backup_timer back_timer[SMP_MAX_CPUS];
 #endif
 
-#define TSC_PER_MS 2200000
-
 static volatile uint64_t timer_current_time; /* in ms */
 static uint64_t timer_delta_time; /* in ms */
 
@@ -52,48 +75,137 @@ static void *callback_arg;
 
 lk_time_t current_time(void)
 {
-    uint64_t val;
-    uint32_t low, high;
-
-    rdtsc(low, high);
-    val = (uint64_t)((uint64_t)high <<32 | (uint64_t)low);
-    timer_current_time = val / TSC_PER_MS;
+    timer_current_time = clock_now_ms();
 
     return timer_current_time;
 }
 
 lk_bigtime_t current_time_hires(void)
 {
-    return timer_current_time * 1000;
+    return clock_now_us();
 }
 
 #if WITH_SM_WALL
 
-static void update_bakcup_timer(uint64_t tv, uint64_t cv)
+/*
+ * Timer slack: a deadline may fire up to slack ms late. Requests whose
+ * window covers the deadline already handed to NS reuse it, others are
+ * rounded up to a slack boundary so that bursts of short sleeps land on
+ * the same NS timer fire.
+ *
+ * The platform timer only ever sees the earliest deadline of the CPU's
+ * timer queue, programmed from whichever context re-arms it, so slack is
+ * a property of the platform timer and not of a thread.
+ */
+static volatile uint64_t timer_slack_ns =
+    MS_TO_NS((uint64_t)PLATFORM_TIMER_SLACK_MS);
+
+status_t platform_timer_set_slack(lk_time_t slack)
+{
+    timer_slack_ns = MS_TO_NS((uint64_t)slack);
+    return NO_ERROR;
+}
+
+static void update_bakcup_timer(uint64_t tv_ns, uint64_t cv_ns)
 {
-    back_timer.tv_ns = MS_TO_NS(tv);
-    back_timer.cv_ns = MS_TO_NS(cv);
+    backup_timer *bt = &back_timer[arch_curr_cpu_num()].timer;
+
+    bt->tv_ns = tv_ns;
+    bt->cv_ns = cv_ns;
     return;
 }
 
 /* Timer will be started at Android side if tv bigger than cv */
-inline static void set_backup_timer(uint64_t interval)
+static void set_backup_timer(lk_time_t interval)
 {
-    update_bakcup_timer(0, interval);
+    struct percpu_backup_timer *pbt = &back_timer[arch_curr_cpu_num()];
+    uint64_t now = clock_now_ns();
+    uint64_t deadline = now + MS_TO_NS((uint64_t)interval);
+    uint64_t slack = timer_slack_ns;
+
+    if (slack && pbt->armed_ns >= deadline &&
+            pbt->armed_ns <= deadline + slack) {
+        deadline = pbt->armed_ns;
+        pbt->coalesced++;
+    } else {
+        if (slack)
+            deadline += slack - 1 - (deadline + slack - 1) % slack;
+        pbt->armed_ns = deadline;
+        pbt->published++;
+    }
+
+    update_bakcup_timer(0, deadline - now);
 }
 
 /* Timer will be stopped at Android side if cv bigger than tv */
 inline static void stop_backup_timer(void)
 {
-    update_bakcup_timer(1, 0);
+    back_timer[arch_curr_cpu_num()].armed_ns = 0;
+    update_bakcup_timer(MS_TO_NS(1ULL), 0);
+}
+
+/*
+ * The deadline handed to NS has fired on this CPU, account how late the
+ * tick arrived relative to it.
+ */
+static void expire_backup_timer(void)
+{
+    struct percpu_backup_timer *pbt = &back_timer[arch_curr_cpu_num()];
+    uint64_t now = clock_now_ns();
+    uint64_t delta;
+
+    if (!pbt->armed_ns)
+        return;
+
+    if (now < pbt->armed_ns) {
+        pbt->early++;
+    } else {
+        delta = now - pbt->armed_ns;
+        if (delta >= TIMER_LATE_NS)
+            pbt->late++;
+        log2_hist_add(&pbt->latency, delta / NS_PER_US);
+    }
+
+    pbt->armed_ns = 0;
+}
+
+void platform_dump_timer_stats(void)
+{
+    struct percpu_backup_timer *pbt;
+    uint32_t cpu;
+
+    for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        pbt = &back_timer[cpu];
+        dprintf(ALWAYS, "cpu%u: timer published %llu coalesced %llu\n", cpu,
+                pbt->published, pbt->coalesced);
+        dprintf(ALWAYS, "cpu%u: tick early %llu late %llu overlapped %llu\n",
+                cpu, pbt->early, pbt->late, pbt->overlapped);
+        log2_hist_dump(&pbt->latency, "us");
+    }
+}
+
+#if WITH_LIB_CONSOLE
+static int cmd_timer_stats(int argc, const cmd_args *argv)
+{
+    platform_dump_timer_stats();
+    return 0;
 }
 
+STATIC_COMMAND_START
+STATIC_COMMAND("timerstat", "dump secure timer latency statistics",
+        &cmd_timer_stats)
+STATIC_COMMAND_END(timerstat);
+#endif
+
+static struct sm_wall_item timer_wall_item[SMP_MAX_CPUS];
+
 static void update_wall_cb(struct sm_wall_item *wi, void *item)
 {
     struct sec_timer_state *wall_tm = item;
+    backup_timer *bt = &back_timer[wi - timer_wall_item].timer;
 
-    wall_tm->tv_ns = back_timer.tv_ns;
-    wall_tm->cv_ns = back_timer.cv_ns;
+    wall_tm->tv_ns = bt->tv_ns;
+    wall_tm->cv_ns = bt->cv_ns;
 
     return;
 }
@@ -153,34 +265,64 @@ status_t platform_set_periodic_timer(platform_timer_callback callback,
 }
 #endif
 
-static enum handler_return os_timer_tick(void *arg)
+static enum handler_return timer_tick(void)
 {
-    enum handler_return ret = INT_NO_RESCHEDULE;
-
-    /*
-     * Soft interrupt is triggered for timer in current solution,
-     * when handling timer interrupt, we need to check whether corresponding bit
-     * of vector is set in Local APIC ISR. Since if bit set in ISR,
-     * it means this interrupt is triggered by external interrupt which belongs
-     * to Non-Secure world, need to redirect this interrupt to NS world.
-     */
-    if (local_apic_vector_in_service(INT_PIT)) {
-        dprintf(CRITICAL, "WARNING: Trusty OS timer vector overlapped!!\n");
-        FW_INT_TO_NS(INT_PIT);
-        ret = sm_handle_irq();
-    } else {
-        if (!t_callback)
-            return INT_NO_RESCHEDULE;
+    if (!t_callback)
+        return INT_NO_RESCHEDULE;
 
 #if !PLATFORM_HAS_DYNAMIC_TIMER
-        timer_current_time += timer_delta_time;
+    timer_current_time += timer_delta_time;
+#elif WITH_SM_WALL
+    expire_backup_timer();
 #endif
-        lk_time_t time = current_time();
+    clock_sync_pvclock();
+
+    lk_time_t time = current_time();
+
+    return t_callback(callback_arg, time);
+}
+
+/*
+ * Entry for SMC_SC_LK_TIMER, runs the timer callback directly instead of
+ * raising INT_PIT through the IDT. Called from the stdcall thread, so
+ * mimic interrupt context and preempt on the way out if asked to.
+ */
+void platform_timer_tick(void)
+{
+    spin_lock_saved_state_t state;
+    enum handler_return ret;
+
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    /* Masked INT_PIT, unmask_interrupt() will run the tick */
+    if (platform_latch_masked_irq(INT_PIT, true)) {
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+        return;
+    }
 
-        ret = t_callback(callback_arg, time);
+    ret = timer_tick();
+    if (ret == INT_RESCHEDULE)
+        thread_preempt();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+/*
+ * INT_PIT is no longer raised by Trusty itself, an APIC interrupt on this
+ * vector belongs to Non-Secure world and has to be redirected there.
+ */
+static enum handler_return os_timer_tick(void *arg)
+{
+    if (local_apic_vector_in_service(INT_PIT)) {
+        dprintf(CRITICAL, "WARNING: Trusty OS timer vector overlapped!!\n");
+#if WITH_SM_WALL
+        back_timer[arch_curr_cpu_num()].overlapped++;
+#endif
+        FW_INT_TO_NS(INT_PIT);
+        return sm_handle_irq();
     }
 
-    return ret;
+    return timer_tick();
 }
 
 void platform_init_timer(void)
@@ -16,7 +16,9 @@
 #include <arch/x86.h>
 #include <arch/local_apic.h>
 #include <lk/init.h>
+#include <debug.h>
 #include <platform/sand.h>
+#include <platform/histogram.h>
 
 static bool lk_boot_complete = false;
 
@@ -57,3 +59,19 @@ LK_INIT_HOOK_FLAGS(set_lk_boot_status, (lk_init_hook) set_lk_boot_complete,
 
 LK_INIT_HOOK_FLAGS(local_apic_reinit, (lk_init_hook) local_apic_reinit,
         LK_INIT_LEVEL_VM + 1, LK_INIT_FLAG_PRIMARY_CPU);
+
+void log2_hist_dump(const struct log2_hist *hist, const char *unit)
+{
+    uint32_t n;
+
+    for (n = 0; n < LOG2_HIST_BUCKETS; n++) {
+        if (!hist->bucket[n])
+            continue;
+
+        if (!n)
+            dprintf(ALWAYS, "    %10u %-4s: %llu\n", 0, unit, hist->bucket[n]);
+        else
+            dprintf(ALWAYS, "  >=%10llu %-4s: %llu\n", 1ULL << (n - 1), unit,
+                    hist->bucket[n]);
+    }
+}
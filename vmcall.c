@@ -17,21 +17,35 @@
 #include <arch/defines.h>
 
 #include <platform/vmcall.h>
+#include <platform/static_call.h>
+#ifdef EPT_DEBUG
+#include <assert.h>
+#include <kernel/spinlock.h>
+#include <lk/init.h>
+#include <platform/sand.h>
+#endif
 
 #define EVMM_SMC_HC_ID                  0x74727500
 #define ACRN_SMC_HC_ID                  0x80000071
 
 #define EVMM_HC_SECINFO                 0x74727509
 
+#define EVMM_HC_PVCLOCK                 0x7472750B
+#define ACRN_HC_PVCLOCK                 0x80000074
+
 #ifdef EPT_DEBUG
 #define EVMM_EPT_UPDATE_HC_ID           0x65707501
+#define EVMM_EPT_BATCH_UPDATE_HC_ID     0x65707502
+
+#define EPT_FLUSH_NONE                  0
+#define EPT_FLUSH_ALL_CPUS              1
 #endif
 
 /* The SMC was called before smc_init() on Simics, then LK will crash.
  * Workaround: initialize make_smc_vmcall with make_smc_vmcall_evmm(). */
-void (*make_smc_vmcall)(smc32_args_t *args, long ret) = make_smc_vmcall_evmm;
+DEFINE_STATIC_CALL(make_smc_vmcall, make_smc_vmcall_evmm);
 
-void make_smc_vmcall_evmm(smc32_args_t *args, long ret)
+void make_smc_vmcall_evmm(smc64_args_t *args, long ret)
 {
     register unsigned long smc_id __asm__("rax") = EVMM_SMC_HC_ID;
 
@@ -44,7 +58,7 @@ void make_smc_vmcall_evmm(smc32_args_t *args, long ret)
     );
 }
 
-void make_smc_vmcall_acrn(smc32_args_t *args, long ret)
+void make_smc_vmcall_acrn(smc64_args_t *args, long ret)
 {
     register unsigned long smc_id __asm__("r8") = ACRN_SMC_HC_ID;
 
@@ -58,12 +72,34 @@ void make_smc_vmcall_acrn(smc32_args_t *args, long ret)
     );
 }
 
+/* Register the pvclock page at pa, 0 on success */
+long make_pvclock_vmcall_evmm(paddr_t pa)
+{
+    long ret;
+
+    __asm__ __volatile__("vmcall" :"=a"(ret) :"a"(EVMM_HC_PVCLOCK), "D"(pa)
+            :"memory");
+
+    return ret;
+}
+
+long make_pvclock_vmcall_acrn(paddr_t pa)
+{
+    register unsigned long hc_id __asm__("r8") = ACRN_HC_PVCLOCK;
+    long ret;
+
+    __asm__ __volatile__("vmcall" :"=a"(ret) :"r"(hc_id), "D"(pa) :"memory");
+
+    return ret;
+}
+
 void make_get_secinfo_vmcall(void *dst) {
     __asm__ __volatile__("vmcall" ::"a"(EVMM_HC_SECINFO), "D"(dst));
 }
 
 #ifdef EPT_DEBUG
-void make_ept_update_vmcall(ept_update_t action, uint64_t start, uint64_t size)
+static void make_ept_single_update_vmcall(ept_update_t action, uint64_t start,
+        uint64_t size)
 {
     uint64_t start_align = ROUNDDOWN(start, PAGE_SIZE);
     uint64_t end_align = ROUNDUP(start+size, PAGE_SIZE);
@@ -81,4 +117,89 @@ void make_ept_update_vmcall(ept_update_t action, uint64_t start, uint64_t size)
         "d"(action), "c"(flush_all_cpus)
     );
 }
+
+/*
+ * Until boot completes, adding regions skips the EPT flush: a page that
+ * was not present cannot be cached by any TLB, and the one flush that
+ * ept_flush_at_boot_end() issues covers any split the VMM had to do.
+ */
+static bool ept_flush_deferred = true;
+static bool ept_flush_pending;
+
+static ept_update_desc_t ept_batch[EPT_BATCH_MAX] __ALIGNED(CACHE_LINE);
+static spin_lock_t ept_batch_lock = SPIN_LOCK_INITIAL_VALUE;
+
+static void ept_batch_vmcall(uint32_t count, uint64_t flush)
+{
+    __asm__ __volatile__(
+        "vmcall;"
+        :
+        :"a"(EVMM_EPT_BATCH_UPDATE_HC_ID),
+        "D"(platform_kernel_paddr(ept_batch)), "S"(count), "d"(flush)
+        :"memory"
+    );
+}
+
+/* Apply up to EPT_BATCH_MAX region updates with one hypercall and one flush */
+void make_ept_batch_update_vmcall(const ept_update_desc_t *desc, uint32_t count)
+{
+    spin_lock_saved_state_t state;
+    uint64_t flush = EPT_FLUSH_NONE;
+    uint32_t i;
+
+    ASSERT(count <= EPT_BATCH_MAX);
+
+    if (!vmm_has_feature(VMM_FEATURE_EPT_BATCH)) {
+        for (i = 0; i < count; i++)
+            make_ept_single_update_vmcall(desc[i].action, desc[i].start,
+                    desc[i].size);
+        return;
+    }
+
+    spin_lock_irqsave(&ept_batch_lock, state);
+
+    for (i = 0; i < count; i++) {
+        ept_batch[i].action = desc[i].action;
+        ept_batch[i].start = ROUNDDOWN(desc[i].start, PAGE_SIZE);
+        ept_batch[i].size = ROUNDUP(desc[i].start + desc[i].size, PAGE_SIZE) -
+            ept_batch[i].start;
+        if (desc[i].action != ADD || !ept_flush_deferred)
+            flush = EPT_FLUSH_ALL_CPUS;
+    }
+
+    if (flush == EPT_FLUSH_NONE)
+        ept_flush_pending = true;
+
+    ept_batch_vmcall(count, flush);
+
+    spin_unlock_irqrestore(&ept_batch_lock, state);
+}
+
+void make_ept_update_vmcall(ept_update_t action, uint64_t start, uint64_t size)
+{
+    ept_update_desc_t desc = {
+        .action = action,
+        .start = start,
+        .size = size,
+    };
+
+    make_ept_batch_update_vmcall(&desc, 1);
+}
+
+static void ept_flush_at_boot_end(uint level)
+{
+    spin_lock_saved_state_t state;
+
+    spin_lock_irqsave(&ept_batch_lock, state);
+
+    ept_flush_deferred = false;
+    if (ept_flush_pending) {
+        ept_batch_vmcall(0, EPT_FLUSH_ALL_CPUS);
+        ept_flush_pending = false;
+    }
+
+    spin_unlock_irqrestore(&ept_batch_lock, state);
+}
+
+LK_INIT_HOOK(ept_flush, ept_flush_at_boot_end, LK_INIT_LEVEL_LAST);
 #endif